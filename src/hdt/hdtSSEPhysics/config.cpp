@@ -2,6 +2,8 @@
 #include "XmlReader.h"
 
 #include "hdtSkyrimPhysicsWorld.h"
+#include "hdtSkinnedMesh/hdtComputeBackend.h"
+#include "hdtSkinnedMesh/hdtSkinnedMeshAlgorithm.h"
 
 #include "../hdtSSEUtils/LogUtils.h"
 
@@ -24,6 +26,82 @@ namespace hdt
 					SkyrimPhysicsWorld::get()->getSolverInfo().m_erp = btClamped(reader.readFloat(), 0.01f, 1.0f);
 				else if (reader.GetLocalName() == "min-fps")
 					TIME_TICK = 1.0f / (btClamped(reader.readInt(), 1, 300));
+				else if (reader.GetLocalName() == "budgetMs")
+					SkyrimPhysicsWorld::get()->setBudget(std::max(reader.readFloat(), 0.f));
+				else if (reader.GetLocalName() == "asyncUpdate")
+					SkyrimPhysicsWorld::get()->setAsyncUpdate(reader.readBool());
+				else if (reader.GetLocalName() == "pairContactBudget")
+					SkinnedMeshAlgorithm::PairContactBudget = btClamped(reader.readInt(), 1, 4096);
+				else if (reader.GetLocalName() == "minPairContactBudget")
+					SkinnedMeshAlgorithm::MinPairContactBudget = btClamped(reader.readInt(), 1, 4096);
+				else if (reader.GetLocalName() == "stepContactBudget")
+					SkinnedMeshAlgorithm::StepContactBudget = std::max(reader.readInt(), 0);
+				else if (reader.GetLocalName() == "computeBackend")
+				{
+					auto name = reader.readText();
+					if (!ComputeBackend::select(name))
+						LogWarning("Compute backend not available : ", name);
+				}
+				else
+				{
+					LogWarning("Unknown config : ", reader.GetLocalName());
+					reader.skipCurrentElement();
+				}
+				break;
+			case XMLReader::Inspected::EndTag:
+				return;
+			}
+		}
+	}
+
+	static void lod(XMLReader& reader)
+	{
+		auto& setting = SkyrimPhysicsWorld::get()->getLODSetting();
+		while (reader.Inspect())
+		{
+			switch (reader.GetInspected())
+			{
+			case XMLReader::Inspected::StartTag:
+				if (reader.GetLocalName() == "enabled")
+					setting.m_enabled = reader.readBool();
+				else if (reader.GetLocalName() == "halfRateDistance")
+					setting.m_halfRateDistance = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "quarterRateDistance")
+					setting.m_quarterRateDistance = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "frozenDistance")
+					setting.m_frozenDistance = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "minScreenSize")
+					setting.m_minScreenSize = btClamped(reader.readFloat(), 0.f, 1.f);
+				else
+				{
+					LogWarning("Unknown config : ", reader.GetLocalName());
+					reader.skipCurrentElement();
+				}
+				break;
+			case XMLReader::Inspected::EndTag:
+				return;
+			}
+		}
+	}
+
+	static void sleep(XMLReader& reader)
+	{
+		auto& setting = SkyrimPhysicsWorld::get()->getSleepSetting();
+		while (reader.Inspect())
+		{
+			switch (reader.GetInspected())
+			{
+			case XMLReader::Inspected::StartTag:
+				if (reader.GetLocalName() == "enabled")
+					setting.m_enabled = reader.readBool();
+				else if (reader.GetLocalName() == "kinematicLinearThreshold")
+					setting.m_kinematicLinearThreshold = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "kinematicAngularThreshold")
+					setting.m_kinematicAngularThreshold = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "energyThreshold")
+					setting.m_energyThreshold = std::max(reader.readFloat(), 0.f);
+				else if (reader.GetLocalName() == "time")
+					setting.m_time = std::max(reader.readFloat(), 0.f);
 				else
 				{
 					LogWarning("Unknown config : ", reader.GetLocalName());
@@ -66,6 +144,10 @@ namespace hdt
 			case XMLReader::Inspected::StartTag:
 				if (reader.GetLocalName() == "solver")
 					solver(reader);
+				else if (reader.GetLocalName() == "lod")
+					lod(reader);
+				else if (reader.GetLocalName() == "sleep")
+					sleep(reader);
 				//else if (reader.GetLocalName() == "wind")
 				//	wind(reader);
 				else
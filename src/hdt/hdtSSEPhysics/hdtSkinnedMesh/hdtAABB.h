@@ -51,6 +51,14 @@ namespace hdt
 			return overlap;*/
 		}
 
+		inline bool contains(const Aabb& rhs) const
+		{
+			auto flag0 = _mm_cmple_ps(m_min, rhs.m_min);
+			auto flag1 = _mm_cmple_ps(rhs.m_max, m_max);
+			auto flag = _mm_movemask_ps(_mm_and_ps(flag0, flag1));
+			return (flag & 0x7) == 7;
+		}
+
 		inline bool collideWithSphere(const btVector3& p, float radius) const
 		{
 			return extended(radius).collideWith(p);
@@ -87,6 +95,71 @@ namespace hdt
 		}
 	};
 
+	// structure of arrays copy of a list of aabbs, for testing one aabb against Width of them at once
+	struct AabbSoA
+	{
+		static constexpr int Width = 8;
+		static bool UseAVX;
+
+		inline size_t size() const { return m_size; }
+		void resize(size_t size);	// storage always reaches Width entries past the end
+		inline void clear() { m_size = 0; }
+
+		inline void set(size_t i, const Aabb& aabb)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				m_min[k][i] = aabb.m_min.m128_f32[k];
+				m_max[k][i] = aabb.m_max.m128_f32[k];
+			}
+		}
+
+		inline void push_back(const Aabb& aabb)
+		{
+			if (m_size + Width >= m_min[0].size())
+				resize(m_size + 1);
+			else ++m_size;
+			set(m_size - 1, aabb);
+		}
+
+		inline Aabb get(size_t i) const
+		{
+			return Aabb(_mm_setr_ps(m_min[0][i], m_min[1][i], m_min[2][i], 0), _mm_setr_ps(m_max[0][i], m_max[1][i], m_max[2][i], 0));
+		}
+
+		// bit j is set if entry i + j overlaps aabb, callers mask out the entries they don't own
+		inline U32 collideMask(size_t i, const Aabb& aabb) const
+		{
+			if (UseAVX)
+			{
+				auto mask = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (int k = 0; k < 3; ++k)
+				{
+					mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_loadu_ps(&m_min[k][i]), _mm256_set1_ps(aabb.m_max.m128_f32[k]), _CMP_LE_OQ));
+					mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_set1_ps(aabb.m_min.m128_f32[k]), _mm256_loadu_ps(&m_max[k][i]), _CMP_LE_OQ));
+				}
+				return _mm256_movemask_ps(mask);
+			}
+
+			auto lo = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			auto hi = lo;
+			for (int k = 0; k < 3; ++k)
+			{
+				auto amax = _mm_set_ps1(aabb.m_max.m128_f32[k]);
+				auto amin = _mm_set_ps1(aabb.m_min.m128_f32[k]);
+				lo = _mm_and_ps(lo, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&m_min[k][i]), amax), _mm_cmple_ps(amin, _mm_loadu_ps(&m_max[k][i]))));
+				hi = _mm_and_ps(hi, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&m_min[k][i + 4]), amax), _mm_cmple_ps(amin, _mm_loadu_ps(&m_max[k][i + 4]))));
+			}
+			return _mm_movemask_ps(lo) | (_mm_movemask_ps(hi) << 4);
+		}
+
+		static inline U32 tailMask(size_t count) { return count >= Width ? (1U << Width) - 1 : (1U << count) - 1; }
+
+		size_t m_size = 0;
+		std::vector<float> m_min[3];
+		std::vector<float> m_max[3];
+	};
+
 	struct BoundingSphere
 	{
 		BoundingSphere() {}
@@ -1 +1,19 @@
 #include "hdtAABB.h"
+
+#include <LinearMath/btCpuFeatureUtility.h>
+
+namespace hdt
+{
+	// FMA3 is only reported with OS support of the ymm registers, and every cpu with it has AVX
+	bool AabbSoA::UseAVX = (btCpuFeatureUtility::getCpuFeatures() & btCpuFeatureUtility::CPU_FEATURE_FMA3) != 0;
+
+	void AabbSoA::resize(size_t size)
+	{
+		m_size = size;
+		for (int k = 0; k < 3; ++k)
+		{
+			m_min[k].resize(size + Width, FLT_MAX);
+			m_max[k].resize(size + Width, -FLT_MAX);
+		}
+	}
+}
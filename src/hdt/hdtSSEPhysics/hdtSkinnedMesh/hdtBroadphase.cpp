@@ -0,0 +1,183 @@
+#include "hdtBroadphase.h"
+#include "hdtSkinnedMeshBody.h"
+
+namespace hdt
+{
+	SkinnedMeshBroadphase::SkinnedMeshBroadphase()
+	{
+	}
+
+	SkinnedMeshBroadphase::~SkinnedMeshBroadphase()
+	{
+		for (auto i : m_proxies)
+			delete i;
+	}
+
+	static inline Aabb proxyAabb(const btBroadphaseProxy* proxy)
+	{
+		return Aabb(proxy->m_aabbMin.get128(), proxy->m_aabbMax.get128());
+	}
+
+	static inline bool needsBroadphaseCollision(const btBroadphaseProxy* a, const btBroadphaseProxy* b)
+	{
+		return (a->m_collisionFilterGroup & b->m_collisionFilterMask) && (b->m_collisionFilterGroup & a->m_collisionFilterMask);
+	}
+
+	btBroadphaseProxy* SkinnedMeshBroadphase::createProxy(const btVector3& aabbMin, const btVector3& aabbMax, int shapeType, void* userPtr, int collisionFilterGroup, int collisionFilterMask, btDispatcher* dispatcher)
+	{
+		auto proxy = new Proxy(aabbMin, aabbMax, userPtr, collisionFilterGroup, collisionFilterMask);
+		proxy->m_uniqueId = m_nextUid++;
+		m_proxies.push_back(proxy);
+
+		// the type is decided once here instead of for every pair in the dispatcher
+		if (collisionFilterMask)
+		{
+			proxy->m_body = SkinnedMeshBody::upcast(static_cast<btCollisionObject*>(userPtr));
+			if (proxy->m_body)
+			{
+				proxy->m_group = getGroup(nullptr);
+				proxy->m_group->m_proxies.push_back(proxy);
+			}
+		}
+		return proxy;
+	}
+
+	void SkinnedMeshBroadphase::destroyProxy(btBroadphaseProxy* proxy, btDispatcher* dispatcher)
+	{
+		auto p = static_cast<Proxy*>(proxy);
+		removeFromGroup(p);
+
+		auto idx = std::find(m_proxies.begin(), m_proxies.end(), p);
+		if (idx != m_proxies.end())
+		{
+			std::swap(*idx, m_proxies.back());
+			m_proxies.pop_back();
+		}
+
+		// pairs of the last step may still be read before the next calculateOverlappingPairs
+		if (p->m_body)
+		{
+			m_pairs.erase(std::remove_if(m_pairs.begin(), m_pairs.end(), [=](const BodyPair& i) {
+				return i.first == p->m_body || i.second == p->m_body;
+			}), m_pairs.end());
+		}
+		delete p;
+	}
+
+	void SkinnedMeshBroadphase::setAabb(btBroadphaseProxy* proxy, const btVector3& aabbMin, const btVector3& aabbMax, btDispatcher* dispatcher)
+	{
+		proxy->m_aabbMin = aabbMin;
+		proxy->m_aabbMax = aabbMax;
+	}
+
+	void SkinnedMeshBroadphase::getAabb(btBroadphaseProxy* proxy, btVector3& aabbMin, btVector3& aabbMax) const
+	{
+		aabbMin = proxy->m_aabbMin;
+		aabbMax = proxy->m_aabbMax;
+	}
+
+	void SkinnedMeshBroadphase::rayTest(const btVector3& rayFrom, const btVector3& rayTo, btBroadphaseRayCallback& rayCallback, const btVector3& aabbMin, const btVector3& aabbMax)
+	{
+		// nothing in the plugin casts rays, the callback does the exact test anyway
+		for (auto i : m_proxies)
+			rayCallback.process(i);
+	}
+
+	void SkinnedMeshBroadphase::aabbTest(const btVector3& aabbMin, const btVector3& aabbMax, btBroadphaseAabbCallback& callback)
+	{
+		Aabb aabb(aabbMin.get128(), aabbMax.get128());
+		for (auto i : m_proxies)
+			if (aabb.collideWith(proxyAabb(i)))
+				callback.process(i);
+	}
+
+	void SkinnedMeshBroadphase::calculateOverlappingPairs(btDispatcher* dispatcher)
+	{
+		m_pairs.clear();
+		m_activeGroups.clear();
+		for (auto& i : m_groups)
+		{
+			auto& group = i.second;
+			if (group.m_proxies.empty()) continue;
+
+			group.m_aabb.invalidate();
+			for (auto j : group.m_proxies)
+				group.m_aabb.merge(proxyAabb(j));
+			m_activeGroups.push_back(&group);
+		}
+
+		auto addPair = [this](Proxy* a, Proxy* b)
+		{
+			if (needsBroadphaseCollision(a, b) && proxyAabb(a).collideWith(proxyAabb(b)))
+				m_pairs.push_back(std::make_pair(a->m_body, b->m_body));
+		};
+
+		for (size_t i = 0; i < m_activeGroups.size(); ++i)
+		{
+			auto& a = m_activeGroups[i]->m_proxies;
+			for (size_t k = 0; k < a.size(); ++k)
+				for (size_t l = k + 1; l < a.size(); ++l)
+					addPair(a[k], a[l]);
+
+			for (size_t j = i + 1; j < m_activeGroups.size(); ++j)
+			{
+				if (m_activeGroups[i]->m_frame != m_activeGroups[j]->m_frame || !m_activeGroups[i]->m_aabb.collideWith(m_activeGroups[j]->m_aabb))
+					continue;
+
+				auto& b = m_activeGroups[j]->m_proxies;
+				for (auto k : a)
+					for (auto l : b)
+						addPair(k, l);
+			}
+		}
+	}
+
+	void SkinnedMeshBroadphase::getBroadphaseAabb(btVector3& aabbMin, btVector3& aabbMax) const
+	{
+		Aabb aabb;
+		for (auto i : m_proxies)
+			aabb.merge(proxyAabb(i));
+		aabbMin = aabb.m_min;
+		aabbMax = aabb.m_max;
+	}
+
+	void SkinnedMeshBroadphase::setGroup(btBroadphaseProxy* proxy, void* group)
+	{
+		auto p = static_cast<Proxy*>(proxy);
+		if (!p || !p->m_group) return;
+
+		removeFromGroup(p);
+		p->m_group = getGroup(group);
+		p->m_group->m_proxies.push_back(p);
+	}
+
+	void SkinnedMeshBroadphase::setGroupFrame(void* group, int frame)
+	{
+		auto iter = m_groups.find(group);
+		if (iter != m_groups.end())
+			iter->second.m_frame = frame;
+	}
+
+	SkinnedMeshBroadphase::Group* SkinnedMeshBroadphase::getGroup(void* key)
+	{
+		return &m_groups[key];
+	}
+
+	void SkinnedMeshBroadphase::removeFromGroup(Proxy* proxy)
+	{
+		if (!proxy->m_group) return;
+
+		auto& list = proxy->m_group->m_proxies;
+		list.erase(std::remove(list.begin(), list.end(), proxy), list.end());
+		if (list.empty())
+		{
+			for (auto i = m_groups.begin(); i != m_groups.end(); ++i)
+				if (&i->second == proxy->m_group)
+				{
+					m_groups.erase(i);
+					break;
+				}
+		}
+		proxy->m_group = nullptr;
+	}
+}
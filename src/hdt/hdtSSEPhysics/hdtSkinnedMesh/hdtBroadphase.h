@@ -0,0 +1,78 @@
+#pragma once
+
+#include "hdtAABB.h"
+
+#include <BulletCollision/BroadphaseCollision/btBroadphaseInterface.h>
+#include <BulletCollision/BroadphaseCollision/btOverlappingPairCache.h>
+#include <unordered_map>
+#include <algorithm>
+
+namespace hdt
+{
+	class SkinnedMeshBody;
+
+	// two level broadphase for skinned mesh bodies. bodies are grouped per skeleton (the system decides, the world sets it),
+	// groups are paired by the aabb of all their bodies first and bodies only inside overlapping groups of the same frame.
+	// bone rigid bodies never collide through the broadphase, their proxies are only kept for bullet's bookkeeping.
+	class SkinnedMeshBroadphase : public btBroadphaseInterface
+	{
+	public:
+		typedef std::pair<SkinnedMeshBody*, SkinnedMeshBody*> BodyPair;
+
+		SkinnedMeshBroadphase();
+		virtual ~SkinnedMeshBroadphase();
+
+		virtual btBroadphaseProxy* createProxy(const btVector3& aabbMin, const btVector3& aabbMax, int shapeType, void* userPtr, int collisionFilterGroup, int collisionFilterMask, btDispatcher* dispatcher) override;
+		virtual void destroyProxy(btBroadphaseProxy* proxy, btDispatcher* dispatcher) override;
+		virtual void setAabb(btBroadphaseProxy* proxy, const btVector3& aabbMin, const btVector3& aabbMax, btDispatcher* dispatcher) override;
+		virtual void getAabb(btBroadphaseProxy* proxy, btVector3& aabbMin, btVector3& aabbMax) const override;
+
+		virtual void rayTest(const btVector3& rayFrom, const btVector3& rayTo, btBroadphaseRayCallback& rayCallback, const btVector3& aabbMin = btVector3(0, 0, 0), const btVector3& aabbMax = btVector3(0, 0, 0)) override;
+		virtual void aabbTest(const btVector3& aabbMin, const btVector3& aabbMax, btBroadphaseAabbCallback& callback) override;
+
+		virtual void calculateOverlappingPairs(btDispatcher* dispatcher) override;
+
+		// body pairs come from getBodyPairs, bullet only sees an empty cache
+		virtual btOverlappingPairCache* getOverlappingPairCache() override { return &m_nullPairCache; }
+		virtual const btOverlappingPairCache* getOverlappingPairCache() const override { return &m_nullPairCache; }
+
+		virtual void getBroadphaseAabb(btVector3& aabbMin, btVector3& aabbMax) const override;
+		virtual void resetPool(btDispatcher* dispatcher) override {}
+		virtual void printStats() override {}
+
+		void setGroup(btBroadphaseProxy* proxy, void* group);
+		// groups in different frames are never paired, their coordinates aren't comparable
+		void setGroupFrame(void* group, int frame);
+		inline const std::vector<BodyPair>& getBodyPairs() const { return m_pairs; }
+
+	protected:
+
+		struct Group;
+
+		struct Proxy : public btBroadphaseProxy
+		{
+			Proxy(const btVector3& aabbMin, const btVector3& aabbMax, void* userPtr, int collisionFilterGroup, int collisionFilterMask)
+				: btBroadphaseProxy(aabbMin, aabbMax, userPtr, collisionFilterGroup, collisionFilterMask) {}
+
+			SkinnedMeshBody* m_body = nullptr;	// null for everything that isn't a skinned mesh body
+			Group* m_group = nullptr;
+		};
+
+		struct Group
+		{
+			std::vector<Proxy*> m_proxies;
+			Aabb m_aabb;
+			int m_frame = 0;
+		};
+
+		Group* getGroup(void* key);
+		void removeFromGroup(Proxy* proxy);
+
+		std::vector<Proxy*> m_proxies;	// every proxy, for queries
+		std::unordered_map<void*, Group> m_groups;
+		std::vector<Group*> m_activeGroups;
+		std::vector<BodyPair> m_pairs;
+		btNullPairCache m_nullPairCache;
+		int m_nextUid = 1;
+	};
+}
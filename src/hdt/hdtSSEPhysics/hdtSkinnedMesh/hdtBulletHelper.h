@@ -143,6 +143,16 @@ namespace hdt
 			return *this;
 		}
 
+		// per component, rotationTolerance for the quaternion and originTolerance for origin and scale
+		inline bool fuzzyEquals(const btQsTransform& rhs, float rotationTolerance, float originTolerance) const
+		{
+			auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+			auto db = _mm_and_ps(_mm_sub_ps(m_basis.get128(), rhs.m_basis.get128()), absMask);
+			auto dt = _mm_and_ps(_mm_sub_ps(m_originScale.get128(), rhs.m_originScale.get128()), absMask);
+			auto eq = _mm_and_ps(_mm_cmple_ps(db, setAll(rotationTolerance)), _mm_cmple_ps(dt, setAll(originTolerance)));
+			return _mm_movemask_ps(eq) == 0xF;
+		}
+
 		inline btQsTransform operator *(const btQsTransform& rhs) const
 		{
 			return btQsTransform(m_basis * rhs.m_basis, *this * rhs.getOrigin(), getScale() * rhs.getScale());
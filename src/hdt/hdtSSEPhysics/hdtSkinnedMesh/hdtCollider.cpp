@@ -5,6 +5,8 @@ namespace hdt
 {
 	static const _CRT_ALIGN(16) U8 interleaveBits[16] = { 0, 1, 8, 9, 64, 65, 72, 73 };
 
+	float ColliderTree::FatMargin = 4.0f;
+
 	void ColliderTree::insertCollider(const std::vector<U32>& keys, const Collider& c)
 	{
 		ColliderTree* p = this;
@@ -22,17 +24,110 @@ namespace hdt
 		p->colliders.push_back(c);
 	}
 
+	static float halfArea(const Aabb& aabb)
+	{
+		btVector3 d = btVector3(aabb.m_max) - btVector3(aabb.m_min);
+		return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+	}
+
+	static void splitBvh(ColliderTree& node, const vectorA16<Collider>& colliders, const vectorA16<Aabb>& bounds, const std::vector<btVector3>& centers, U32* begin, U32* end, U32 maxLeaf)
+	{
+		static const int Bins = 12;
+
+		U32 n = static_cast<U32>(end - begin);
+		Aabb centerBounds;
+		for (auto i = begin; i < end; ++i)
+			centerBounds.merge(centers[*i]);
+
+		btVector3 extent = btVector3(centerBounds.m_max) - btVector3(centerBounds.m_min);
+		int axis = extent.maxAxis();
+		if (n <= maxLeaf || extent[axis] < FLT_EPSILON)
+		{
+			for (auto i = begin; i < end; ++i)
+				node.colliders.push_back(colliders[*i]);
+			return;
+		}
+
+		float lo = btVector3(centerBounds.m_min)[axis];
+		float scale = Bins / extent[axis];
+		auto binOf = [&](U32 i) { return std::min(static_cast<int>((centers[i][axis] - lo) * scale), Bins - 1); };
+
+		Aabb binAabb[Bins];
+		U32 binCount[Bins] = {};
+		for (auto i = begin; i < end; ++i)
+		{
+			int b = binOf(*i);
+			binAabb[b].merge(bounds[*i]);
+			++binCount[b];
+		}
+
+		// sweep from the right, then pick the cheapest plane from the left
+		float rightCost[Bins];
+		Aabb aabb;
+		U32 count = 0;
+		for (int i = Bins - 1; i > 0; --i)
+		{
+			aabb.merge(binAabb[i]);
+			count += binCount[i];
+			rightCost[i] = count ? count * halfArea(aabb) : 0;
+		}
+
+		int best = 0;
+		float bestCost = FLT_MAX;
+		aabb.invalidate();
+		count = 0;
+		for (int i = 0; i < Bins - 1; ++i)
+		{
+			aabb.merge(binAabb[i]);
+			count += binCount[i];
+			if (!count || count == n) continue;
+
+			float cost = count * halfArea(aabb) + rightCost[i + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				best = i;
+			}
+		}
+
+		auto mid = std::partition(begin, end, [&](U32 i) { return binOf(i) <= best; });
+		node.children.resize(2);
+		splitBvh(node.children[0], colliders, bounds, centers, begin, mid, maxLeaf);
+		splitBvh(node.children[1], colliders, bounds, centers, mid, end, maxLeaf);
+	}
+
+	void ColliderTree::buildBvh(const std::function<Aabb(const Collider*)>& func, U32 maxLeaf)
+	{
+		vectorA16<Collider> all;
+		visitColliders([&](Collider* c) { all.push_back(*c); });
+		children.clear();
+		colliders.clear();
+
+		vectorA16<Aabb> bounds;
+		std::vector<btVector3> centers;
+		std::vector<U32> order;
+		for (U32 i = 0; i < all.size(); ++i)
+		{
+			bounds.push_back(func(&all[i]));
+			centers.push_back((btVector3(bounds[i].m_min) + btVector3(bounds[i].m_max)) * 0.5f);
+			order.push_back(i);
+		}
+
+		if (!order.empty())
+			splitBvh(*this, all, bounds, centers, order.data(), order.data() + order.size(), maxLeaf);
+	}
+
 	void ColliderTree::checkCollisionL(ColliderTree* r, std::vector<std::pair<ColliderTree*, ColliderTree*>>& ret)
 	{
 		if (isKinematic && r->isKinematic)
 			return;
 
-		if (!aabbAll.collideWith(r->aabbAll))
+		if (!aabbAllFat.collideWith(r->aabbAllFat))
 			return;
 
-		if (numCollider && aabbMe.collideWith(r->aabbAll))
+		if (numCollider && aabbMeFat.collideWith(r->aabbAllFat))
 		{
-			if (aabbMe.collideWith(r->aabbMe))
+			if (aabbMeFat.collideWith(r->aabbMeFat))
 				ret.push_back(std::make_pair(this, r));
 
 			auto begin = r->children.data();
@@ -54,10 +149,10 @@ namespace hdt
 
 		if (numCollider)
 		{
-			if (!aabbMe.collideWith(r->aabbAll))
+			if (!aabbMeFat.collideWith(r->aabbAllFat))
 				return;
 
-			if (aabbMe.collideWith(r->aabbMe))
+			if (aabbMeFat.collideWith(r->aabbMeFat))
 				ret.push_back(std::make_pair(this, r));
 
 			auto begin = r->children.data();
@@ -131,6 +226,45 @@ namespace hdt
 		}
 	}
 
+	void ColliderTree::updateAabbRegion()
+	{
+		if (numCollider && inRegion)
+		{
+			Aabb aabb = *this->aabb;
+			auto aabbEnd = this->aabb + numCollider;
+			for (auto i = this->aabb + 1; i < aabbEnd; ++i)
+				aabb.merge(*i);
+			aabbMe = aabb;
+		}
+		else aabbMe.invalidate();
+
+		aabbAll = aabbMe;
+		for (auto& i : children)
+		{
+			i.updateAabbRegion();
+			aabbAll.merge(i.aabbAll);
+		}
+	}
+
+	bool ColliderTree::updateFatAabb()
+	{
+		bool changed = false;
+		if (!aabbMeFat.contains(aabbMe))
+		{
+			aabbMeFat = aabbMe.extended(FatMargin);
+			changed = true;
+		}
+		if (!aabbAllFat.contains(aabbAll))
+		{
+			aabbAllFat = aabbAll.extended(FatMargin);
+			changed = true;
+		}
+
+		for (auto& i : children)
+			changed |= i.updateFatAabb();
+		return changed;
+	}
+
 	void ColliderTree::visitColliders(const std::function<void(Collider*)>& func)
 	{
 		for (auto& i : colliders)
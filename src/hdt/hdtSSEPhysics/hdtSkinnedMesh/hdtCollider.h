@@ -37,6 +37,8 @@ namespace hdt
 
 		Aabb aabbAll;
 		Aabb aabbMe;
+		Aabb aabbAllFat;	// aabbAll and aabbMe grown by FatMargin, only refreshed when they leave it
+		Aabb aabbMeFat;
 
 		U32 isKinematic;
 
@@ -51,7 +53,14 @@ namespace hdt
 		vectorA16<Collider> colliders;
 		U32 key;
 
+		// region skinning, own colliders only
+		std::vector<U32> regionBones;		// skinned bones moving their vertices
+		std::vector<U32> regionVertices;	// their vertices
+		U32 inRegion = true;
+
 		void insertCollider(const std::vector<U32>& keys, const Collider& c);
+		// rebuilds the tree spatially with SAH over the rest pose bounds of the colliders, instead of by bone keys
+		void buildBvh(const std::function<Aabb(const Collider*)>& func, U32 maxLeaf = 4);
 		void exportColliders(vectorA16<Collider>& exportTo);
 		void remapColliders(Collider* start, Aabb* startAabb);
 
@@ -61,14 +70,28 @@ namespace hdt
 		void updateKinematic(const std::function<float(const Collider*)>& func);
 		void visitColliders(const std::function<void(Collider*)>& func);
 		void updateAabb();
+		void updateAabbRegion();	// nodes out of the region are left empty, they can't collide
+		bool updateFatAabb();		// returns true if any fat bound had to be refreshed
 		void optimize();
 
+		static float FatMargin;
+
 		inline bool empty() const { return children.empty() && colliders.empty(); }
 
 
 		bool collapseCollideL(ColliderTree* r);
 		bool collapseCollideR(ColliderTree* r);
 	};
+	// node pairs found between two trees with their fat bounds. they stay a superset of the overlapping pairs
+	// as long as neither tree refreshed a fat bound, so the traversal can be skipped
+	struct ColliderPairCache
+	{
+		U32 version0 = ~0U;	// fat versions of the two shapes the pairs were found with
+		U32 version1 = ~0U;
+		bool used = false;
+		std::vector<std::pair<ColliderTree*, ColliderTree*>> pairs;
+	};
+
 	/*
 	struct _CRT_ALIGN(16) ColliderTree
 	{
@@ -96,6 +96,142 @@ namespace hdt
 	}
 
 
+	void SphereTriangleBatch::clear()
+	{
+		m_size = 0;
+		for (auto& i : m_data)
+			i.clear();
+	}
+
+	void SphereTriangleBatch::add(const btVector3& s, float r, const btVector3& p0, const btVector3& p1, const btVector3& p2, float margin, float penetration)
+	{
+		const float values[NumFields] = {
+			s.x(), s.y(), s.z(), r,
+			p0.x(), p0.y(), p0.z(),
+			p1.x(), p1.y(), p1.z(),
+			p2.x(), p2.y(), p2.z(),
+			margin, penetration
+		};
+		for (int i = 0; i < NumFields; ++i)
+			m_data[i].push_back(values[i]);
+		++m_size;
+	}
+
+	int SphereTriangleBatch::deepest()
+	{
+		auto field = [this](int f, size_t i) { return btVector3(m_data[f][i], m_data[f + 1][i], m_data[f + 2][i]); };
+
+		int ret = -1;
+		float best = FLT_MAX;
+		if (!AabbSoA::UseAVX)
+		{
+			CollisionResult res;
+			for (size_t i = 0; i < m_size; ++i)
+			{
+				CheckTriangle tri(field(P0X, i), field(P1X, i), field(P2X, i), m_data[Margin][i], m_data[Penetration][i]);
+				if (tri.valid && checkSphereTriangle(field(SX, i), m_data[R][i], tri, res) && res.depth < best)
+				{
+					best = res.depth;
+					ret = static_cast<int>(i);
+				}
+			}
+			return ret;
+		}
+
+		// zero padding is a degenerated triangle, never a contact
+		size_t padded = (m_size + Width - 1) / Width * Width;
+		for (auto& i : m_data)
+			i.resize(padded, 0.f);
+
+		auto cmp = [](__m256 a, __m256 b, int op) { return _mm256_cmp_ps(a, b, op); };
+		auto dot = [](__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+			return _mm256_fmadd_ps(ax, bx, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(az, bz)));
+		};
+		auto zero = _mm256_setzero_ps();
+		auto eps = _mm256_set1_ps(FLT_EPSILON);
+		auto sign = _mm256_set1_ps(-0.f);
+		auto bestDepth = _mm256_set1_ps(FLT_MAX);
+		auto bestIdx = _mm256_set1_ps(-1);
+		auto idx = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);	// float lanes, integer adds would need AVX2
+
+		for (size_t i = 0; i < padded; i += Width)
+		{
+			__m256 v[NumFields];
+			for (int f = 0; f < NumFields; ++f)
+				v[f] = _mm256_loadu_ps(&m_data[f][i]);
+
+			// CheckTriangle
+			auto abx = _mm256_sub_ps(v[P1X], v[P0X]), aby = _mm256_sub_ps(v[P1Y], v[P0Y]), abz = _mm256_sub_ps(v[P1Z], v[P0Z]);
+			auto acx = _mm256_sub_ps(v[P2X], v[P0X]), acy = _mm256_sub_ps(v[P2Y], v[P0Y]), acz = _mm256_sub_ps(v[P2Z], v[P0Z]);
+			auto nx = _mm256_fmsub_ps(aby, acz, _mm256_mul_ps(abz, acy));
+			auto ny = _mm256_fmsub_ps(abz, acx, _mm256_mul_ps(abx, acz));
+			auto nz = _mm256_fmsub_ps(abx, acy, _mm256_mul_ps(aby, acx));
+			auto len2 = dot(nx, ny, nz, nx, ny, nz);
+			auto valid = cmp(len2, _mm256_mul_ps(eps, eps), _CMP_GE_OQ);
+			auto inv = _mm256_rsqrt_ps(len2);
+			inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), len2), _mm256_mul_ps(inv, inv), _mm256_set1_ps(1.5f)));
+
+			auto penetration = v[Penetration];
+			auto absPenetration = _mm256_andnot_ps(sign, penetration);
+			penetration = _mm256_andnot_ps(cmp(absPenetration, eps, _CMP_LT_OQ), penetration);
+			auto flip = _mm256_and_ps(penetration, sign);	// triangle facing the other way
+			penetration = _mm256_andnot_ps(sign, penetration);
+
+			// checkSphereTriangle, the distance from the plane decides the depth
+			auto apx = _mm256_sub_ps(v[SX], v[P0X]), apy = _mm256_sub_ps(v[SY], v[P0Y]), apz = _mm256_sub_ps(v[SZ], v[P0Z]);
+			auto dist = _mm256_xor_ps(_mm256_mul_ps(dot(apx, apy, apz, nx, ny, nz), inv), flip);
+			auto radiusWithMargin = _mm256_add_ps(v[R], v[Margin]);
+
+			auto single = cmp(penetration, eps, _CMP_GE_OQ);
+			auto insideSingle = _mm256_and_ps(cmp(dist, radiusWithMargin, _CMP_LT_OQ), cmp(dist, _mm256_xor_ps(penetration, sign), _CMP_GE_OQ));
+			dist = _mm256_blendv_ps(_mm256_andnot_ps(sign, dist), dist, single);
+			auto insideDouble = cmp(dist, _mm256_xor_ps(radiusWithMargin, sign), _CMP_GT_OQ);
+			auto inside = _mm256_blendv_ps(insideDouble, insideSingle, single);
+
+			// pointInTriangle
+			auto bpx = _mm256_sub_ps(v[SX], v[P1X]), bpy = _mm256_sub_ps(v[SY], v[P1Y]), bpz = _mm256_sub_ps(v[SZ], v[P1Z]);
+			auto cpx = _mm256_sub_ps(v[SX], v[P2X]), cpy = _mm256_sub_ps(v[SY], v[P2Y]), cpz = _mm256_sub_ps(v[SZ], v[P2Z]);
+			auto d1 = dot(abx, aby, abz, apx, apy, apz);
+			auto d2 = dot(acx, acy, acz, apx, apy, apz);
+			auto d3 = dot(abx, aby, abz, bpx, bpy, bpz);
+			auto d4 = dot(acx, acy, acz, bpx, bpy, bpz);
+			auto d5 = dot(abx, aby, abz, cpx, cpy, cpz);
+			auto d6 = dot(acx, acy, acz, cpx, cpy, cpz);
+			auto vc = _mm256_fmsub_ps(d1, d4, _mm256_mul_ps(d3, d2));
+			auto vb = _mm256_fmsub_ps(d5, d2, _mm256_mul_ps(d1, d6));
+			auto va = _mm256_fmsub_ps(d3, d6, _mm256_mul_ps(d5, d4));
+			auto outside = _mm256_and_ps(cmp(d1, zero, _CMP_LE_OQ), cmp(d2, zero, _CMP_LE_OQ));
+			outside = _mm256_or_ps(outside, _mm256_and_ps(cmp(d3, zero, _CMP_GE_OQ), cmp(d4, d3, _CMP_LE_OQ)));
+			outside = _mm256_or_ps(outside, _mm256_and_ps(cmp(d6, zero, _CMP_GE_OQ), cmp(d5, d6, _CMP_LE_OQ)));
+			outside = _mm256_or_ps(outside, _mm256_and_ps(cmp(vc, zero, _CMP_LE_OQ), _mm256_and_ps(cmp(d1, zero, _CMP_GE_OQ), cmp(d3, zero, _CMP_LE_OQ))));
+			outside = _mm256_or_ps(outside, _mm256_and_ps(cmp(vb, zero, _CMP_LE_OQ), _mm256_and_ps(cmp(d2, zero, _CMP_GE_OQ), cmp(d6, zero, _CMP_LE_OQ))));
+			outside = _mm256_or_ps(outside, _mm256_and_ps(cmp(va, zero, _CMP_LE_OQ), _mm256_and_ps(cmp(d4, d3, _CMP_GE_OQ), cmp(d5, d6, _CMP_GE_OQ))));
+
+			auto depth = _mm256_sub_ps(dist, radiusWithMargin);
+			auto hit = _mm256_and_ps(_mm256_and_ps(valid, inside), _mm256_andnot_ps(outside, cmp(depth, _mm256_xor_ps(eps, sign), _CMP_LT_OQ)));
+			hit = _mm256_and_ps(hit, cmp(depth, bestDepth, _CMP_LT_OQ));
+			bestDepth = _mm256_blendv_ps(bestDepth, depth, hit);
+			bestIdx = _mm256_blendv_ps(bestIdx, idx, hit);
+			idx = _mm256_add_ps(idx, _mm256_set1_ps(Width));
+		}
+
+		_CRT_ALIGN(32) float depths[Width];
+		_CRT_ALIGN(32) float indices[Width];
+		_mm256_store_ps(depths, bestDepth);
+		_mm256_store_ps(indices, bestIdx);
+		for (int i = 0; i < Width; ++i)
+		{
+			int index = static_cast<int>(indices[i]);
+			if (index < 0) continue;
+			if (depths[i] < best || (depths[i] == best && index < ret))
+			{
+				best = depths[i];
+				ret = index;
+			}
+		}
+		return ret;
+	}
+
 	bool checkSphereSphere(const btVector3& a, const btVector3& b, float ra, float rb, CollisionResult& res)
 	{
 		btVector3 diff = a - b;
@@ -23,6 +23,23 @@ namespace hdt
 		bool valid;
 	};
 
+	// sphere / triangle candidates in structure of arrays form. the deepest contact is searched Width at a time
+	// without branches, its details are left to checkSphereTriangle
+	struct SphereTriangleBatch
+	{
+		static constexpr int Width = 8;
+
+		enum { SX, SY, SZ, R, P0X, P0Y, P0Z, P1X, P1Y, P1Z, P2X, P2Y, P2Z, Margin, Penetration, NumFields };
+
+		inline size_t size() const { return m_size; }
+		void clear();
+		void add(const btVector3& s, float r, const btVector3& p0, const btVector3& p1, const btVector3& p2, float margin, float penetration);
+		int deepest();	// index of the deepest contact, -1 if none
+
+		size_t m_size = 0;
+		std::vector<float> m_data[NumFields];
+	};
+
 	bool checkSphereSphere(const btVector3& a, const btVector3& b, float ra, float rb, CollisionResult& res);
 	bool checkSphereTriangle(const btVector3& s, float r, const CheckTriangle& tri, CollisionResult& res);
 	bool checkTriangleSphere(const btVector3& s, float r, const CheckTriangle& tri, CollisionResult& res);
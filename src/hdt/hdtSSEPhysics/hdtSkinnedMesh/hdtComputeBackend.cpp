@@ -0,0 +1,202 @@
+#include "hdtComputeBackend.h"
+#include "hdtSkinnedMeshBody.h"
+#include "hdtSkinnedMeshShape.h"
+
+#include <ppl.h>
+#include <memory>
+
+#ifdef ENABLE_CL
+#include <CL/cl.hpp>
+#include <mutex>
+#include <unordered_map>
+#endif
+
+namespace hdt
+{
+	void CpuComputeBackend::update(Batch& batch)
+	{
+		concurrency::parallel_for_each(batch.begin(), batch.end(), [](std::pair<SkinnedMeshBody*, vectorA16<Aabb>>& i) {
+			i.first->internalUpdateRegion(i.second);
+		});
+	}
+
+#ifdef ENABLE_CL
+
+	static const char* sourceVertices = R"__KERNEL(
+typedef struct Vertex
+{
+	float4 skinPos;
+	float weight[4];
+	uint boneIdx[4];
+} Vertex;
+
+typedef struct Bone
+{
+	float4 col[4];
+	float reserved[3];
+	float margin;
+} Bone;
+
+__kernel void updateVertices(
+	__global const Bone* bones,
+	__global const Vertex* vertices,
+	__global float4* out)
+{
+	int idx = get_global_id(0);
+	Vertex v = vertices[idx];
+	float4 pos = 0;
+	for(int i=0; i<4; ++i)
+	{
+		if(i == 0 || v.weight[i] > FLT_EPSILON)
+		{
+			__global const Bone* b = &bones[v.boneIdx[i]];
+			float4 p = b->col[0] * v.skinPos.x + b->col[1] * v.skinPos.y + b->col[2] * v.skinPos.z + b->col[3];
+			p.w = b->margin;
+			pos += p * v.weight[i];
+		}
+	}
+	out[idx] = pos;
+}
+)__KERNEL";
+
+	// skins whole bodies on the first gpu found, collider aabbs are still updated on the cpu from the read back vertices
+	class OpenCLComputeBackend : public ComputeBackend
+	{
+	public:
+		bool init()
+		{
+			std::vector<cl::Platform> platforms;
+			if (cl::Platform::get(&platforms) != CL_SUCCESS)
+				return false;
+
+			for (auto& i : platforms)
+			{
+				std::vector<cl::Device> devices;
+				if (i.getDevices(CL_DEVICE_TYPE_GPU, &devices) == CL_SUCCESS && !devices.empty())
+				{
+					m_device = devices[0];
+					break;
+				}
+			}
+			if (!m_device())
+				return false;
+
+			cl_int err;
+			m_context = cl::Context(m_device, nullptr, nullptr, nullptr, &err);
+			if (err != CL_SUCCESS) return false;
+			m_queue = cl::CommandQueue(m_context, m_device, 0, &err);
+			if (err != CL_SUCCESS) return false;
+
+			cl::Program program(m_context, sourceVertices, false, &err);
+			if (err != CL_SUCCESS || program.build({ m_device }) != CL_SUCCESS)
+				return false;
+			m_kernel = cl::Kernel(program, "updateVertices", &err);
+			return err == CL_SUCCESS;
+		}
+
+		virtual const char* getName() const override { return "opencl"; }
+
+		virtual void update(Batch& batch) override
+		{
+			SpinLock lock;
+			std::vector<SkinnedMeshBody*> dirty;
+			concurrency::parallel_for_each(batch.begin(), batch.end(), [&](std::pair<SkinnedMeshBody*, vectorA16<Aabb>>& i) {
+				if (i.first->prepareUpdate())
+				{
+					HDT_LOCK_GUARD(l, lock);
+					dirty.push_back(i.first);
+				}
+			});
+			if (dirty.empty()) return;
+
+			// everything is queued before the only wait of the step
+			{
+				std::lock_guard<std::mutex> l(m_lock);
+				for (auto body : dirty)
+				{
+					auto& buffers = getBuffers(body);
+					m_queue.enqueueWriteBuffer(buffers.bones, CL_FALSE, 0, sizeof(Bone) * body->m_bones.size(), body->m_bones.data());
+					m_kernel.setArg(0, buffers.bones);
+					m_kernel.setArg(1, buffers.vertices);
+					m_kernel.setArg(2, buffers.vpos);
+					m_queue.enqueueNDRangeKernel(m_kernel, cl::NullRange, cl::NDRange(body->m_vertices.size()));
+					m_queue.enqueueReadBuffer(buffers.vpos, CL_FALSE, 0, sizeof(VertexPos) * body->m_vpos.size(), body->m_vpos.data());
+				}
+				m_queue.finish();
+			}
+
+			concurrency::parallel_for_each(dirty.begin(), dirty.end(), [](SkinnedMeshBody* body) {
+				body->finishUpdate();
+			});
+		}
+
+		virtual void release(SkinnedMeshBody* body) override
+		{
+			std::lock_guard<std::mutex> l(m_lock);
+			m_buffers.erase(body);
+		}
+
+	protected:
+
+		struct BodyBuffers
+		{
+			cl::Buffer bones;
+			cl::Buffer vertices;
+			cl::Buffer vpos;
+		};
+
+		BodyBuffers& getBuffers(SkinnedMeshBody* body)
+		{
+			auto& ret = m_buffers[body];
+			if (!ret.vertices())
+			{
+				ret.bones = cl::Buffer(m_context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(Bone) * body->m_bones.size());
+				ret.vertices = cl::Buffer(m_context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, sizeof(Vertex) * body->m_vertices.size());
+				ret.vpos = cl::Buffer(m_context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(VertexPos) * body->m_vpos.size());
+				m_queue.enqueueWriteBuffer(ret.vertices, CL_FALSE, 0, sizeof(Vertex) * body->m_vertices.size(), body->m_vertices.data());
+			}
+			return ret;
+		}
+
+		cl::Device			m_device;
+		cl::Context			m_context;
+		cl::CommandQueue	m_queue;
+		cl::Kernel			m_kernel;
+		std::mutex			m_lock;
+		std::unordered_map<SkinnedMeshBody*, BodyBuffers> m_buffers;
+	};
+
+#endif
+
+	static std::unique_ptr<ComputeBackend> s_backend(new CpuComputeBackend);
+
+	ComputeBackend* ComputeBackend::get()
+	{
+		return s_backend.get();
+	}
+
+	bool ComputeBackend::select(const std::string& name)
+	{
+		if (name == s_backend->getName())
+			return true;
+
+		if (name == "cpu")
+		{
+			s_backend.reset(new CpuComputeBackend);
+			return true;
+		}
+
+#ifdef ENABLE_CL
+		if (name == "opencl")
+		{
+			std::unique_ptr<OpenCLComputeBackend> backend(new OpenCLComputeBackend);
+			if (!backend->init())
+				return false;
+			s_backend = std::move(backend);
+			return true;
+		}
+#endif
+
+		return false;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hdtAABB.h"
+#include <string>
+#include <vector>
+
+namespace hdt
+{
+	class SkinnedMeshBody;
+
+	// skinning and collider aabb update of all bodies touched in a step, done as one batch
+	class ComputeBackend
+	{
+	public:
+		// every body once, with the aabbs it has to be skinned for
+		typedef std::vector<std::pair<SkinnedMeshBody*, vectorA16<Aabb>>> Batch;
+
+		virtual ~ComputeBackend() {}
+
+		virtual const char* getName() const = 0;
+		virtual void update(Batch& batch) = 0;
+		virtual void release(SkinnedMeshBody* body) {}	// called when the body is destroyed
+
+		static ComputeBackend* get();
+		static bool select(const std::string& name);	// keeps the current backend if name isn't available
+	};
+
+	// multithreaded SIMD skinning, the default
+	class CpuComputeBackend : public ComputeBackend
+	{
+	public:
+		virtual const char* getName() const override { return "cpu"; }
+		virtual void update(Batch& batch) override;
+	};
+}
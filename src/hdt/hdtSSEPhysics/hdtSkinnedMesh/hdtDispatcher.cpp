@@ -1,6 +1,7 @@
 #include "hdtDispatcher.h"
 #include "hdtSkinnedMeshBody.h"
 #include "hdtSkinnedMeshAlgorithm.h"
+#include "hdtComputeBackend.h"
 
 #include <LinearMath\btPoolAllocator.h>
 namespace hdt
@@ -27,13 +28,35 @@ namespace hdt
 		if (shape0->m_isKinematic && shape1->m_isKinematic)
 			return false;
 
+		if (!shape0->isActive() || !shape1->isActive())
+			return false;
+
 		return shape0->canCollideWith(shape1) && shape1->canCollideWith(shape0);
 	}
 
+	// an awake body touching a sleeping one wakes its system up after this step. returns the body to wake, only read here,
+	// the pairs of this dispatch keep seeing it asleep
+	static SkinnedMeshBody* findTouched(SkinnedMeshBody* shape0, SkinnedMeshBody* shape1)
+	{
+		if (!shape0 || !shape1 || shape0->isActive() == shape1->isActive())
+			return nullptr;
+
+		auto sleeping = shape0->isActive() ? shape1 : shape0;
+		if (sleeping->getActivationState() != ISLAND_SLEEPING)
+			return nullptr;
+
+		if (shape0->m_isKinematic && shape1->m_isKinematic)
+			return nullptr;
+
+		if (shape0->canCollideWith(shape1) && shape1->canCollideWith(shape0))
+			return sleeping;
+		return nullptr;
+	}
+
 	bool CollisionDispatcher::needsCollision(const btCollisionObject* body0, const btCollisionObject* body1)
 	{
-		auto shape0 = dynamic_cast<const SkinnedMeshBody*>(body0);
-		auto shape1 = dynamic_cast<const SkinnedMeshBody*>(body1);
+		auto shape0 = SkinnedMeshBody::upcast(body0);
+		auto shape1 = SkinnedMeshBody::upcast(body1);
 
 		if (shape0 || shape1)
 		{
@@ -46,7 +69,7 @@ namespace hdt
 			if (body0->checkCollideWith(body1) || body1->checkCollideWith(body0))
 			{
 				auto rb0 = static_cast<SkinnedMeshBone*>(body0->getUserPointer());
-				auto rb1 = static_cast<SkinnedMeshBone*>(body0->getUserPointer());
+				auto rb1 = static_cast<SkinnedMeshBone*>(body1->getUserPointer());
 
 				return rb0->canCollideWith(rb1) && rb1->canCollideWith(rb0);
 			}
@@ -56,60 +79,134 @@ namespace hdt
 
 	void CollisionDispatcher::dispatchAllCollisionPairs(btOverlappingPairCache* pairCache, const btDispatcherInfo& dispatchInfo, btDispatcher* dispatcher)
 	{
+		auto& bodyPairs = m_broadphase->getBodyPairs();
 		auto size = pairCache->getNumOverlappingPairs();
-		if (!size) return;
+		if (bodyPairs.empty() && !size) return;
 
-		m_pairs.reserve(size);
 		auto pairs = pairCache->getOverlappingPairArrayPtr();
+		++m_epoch;
 
-		SpinLock lock;
-		std::unordered_set<SkinnedMeshBody*> bodies;
-		std::unordered_set<PerTriangleShape*> shapes;
-
-		concurrency::parallel_for(0, size, [&](int i)
+		// pairs of skinned mesh bodies come typed from the broadphase, each thread gathers into its own buffer
+		concurrency::parallel_for_each(bodyPairs.begin(), bodyPairs.end(), [&](const SkinnedMeshBroadphase::BodyPair& i)
 		{
-			auto& pair = pairs[i];
+			auto shape0 = i.first;
+			auto shape1 = i.second;
 
-			auto shape0 = dynamic_cast<SkinnedMeshBody*>((btCollisionObject*)pair.m_pProxy0->m_clientObject);
-			auto shape1 = dynamic_cast<SkinnedMeshBody*>((btCollisionObject*)pair.m_pProxy1->m_clientObject);
+			if (!::hdt::needsCollision(shape0, shape1))
+			{
+				auto touched = findTouched(shape0, shape1);
+				if (touched)
+					m_gather.local().touched.push_back(touched);
+				return;
+			}
 
-			if (shape0 || shape1)
+			// only the bones whose spheres touch the other body are skinned for it
+			thread_local SkinnedMeshBody::BonePairs bonePairs;
+			thread_local std::vector<int> bones0, bones1;
+			if (!shape0->isBoundingSphereCollided(shape1, bonePairs))
+				return;
+
+			bones0.clear();
+			bones1.clear();
+			for (auto& j : bonePairs)
 			{
-				if (::hdt::needsCollision(shape0, shape1) && shape0->isBoundingSphereCollided(shape1))
-				{
-					HDT_LOCK_GUARD(l, lock);
+				bones0.push_back(j.first);
+				bones1.push_back(j.second);
+			}
+			std::sort(bones0.begin(), bones0.end());
+			bones0.erase(std::unique(bones0.begin(), bones0.end()), bones0.end());
+			std::sort(bones1.begin(), bones1.end());
+			bones1.erase(std::unique(bones1.begin(), bones1.end()), bones1.end());
+
+			auto& local = m_gather.local();
+			for (auto j : bones1)
+				local.regions.push_back(std::make_pair(shape0, shape1->getBoneRegion(j)));
+			for (auto j : bones0)
+				local.regions.push_back(std::make_pair(shape1, shape0->getBoneRegion(j)));
+			local.pairs.push_back(std::make_pair(shape0, shape1));
+		});
 
-					bodies.insert(shape0);
-					bodies.insert(shape1);
+		// serial merge, bodies and shapes already seen this dispatch are told apart by their epoch
+		ComputeBackend::Batch bodies;	// with the aabbs of the bodies they may touch
+		std::vector<PerTriangleShape*> shapes;
+		m_gather.combine_each([&, this](GatherBuffer& local)
+		{
+			for (auto& i : local.regions)
+			{
+				auto body = i.first;
+				if (body->m_dispatchEpoch != m_epoch)
+				{
+					body->m_dispatchEpoch = m_epoch;
+					body->m_batchIndex = static_cast<U32>(bodies.size());
+					bodies.push_back(std::make_pair(body, vectorA16<Aabb>()));
+				}
+				bodies[body->m_batchIndex].second.push_back(i.second);
+			}
 
-					m_pairs.push_back(std::make_pair(shape0, shape1));
+			for (auto& i : local.pairs)
+			{
+				m_pairs.push_back(i);
 
-					auto a = shape0->m_shape->asPerTriangleShape();
-					auto b = shape1->m_shape->asPerTriangleShape();
-					if (a && b)
+				auto a = i.first->m_shape->asPerTriangleShape();
+				auto b = i.second->m_shape->asPerTriangleShape();
+				if (a && b)
+				{
+					for (auto shape : { a, b })
 					{
-						shapes.insert(a);
-						shapes.insert(b);
+						if (shape->m_dispatchEpoch == m_epoch) continue;
+						shape->m_dispatchEpoch = m_epoch;
+						shapes.push_back(shape);
 					}
 				}
 			}
-			else getNearCallback()(pair, *this, dispatchInfo);
-		});
 
-		concurrency::parallel_for_each(bodies.begin(), bodies.end(), [](SkinnedMeshBody* shape) {
-			shape->internalUpdate();
+			for (auto i : local.touched)
+				i->activate(true);
+
+			local.regions.clear();
+			local.pairs.clear();
+			local.touched.clear();
 		});
+
+		// anything else bullet may have paired
+		for (int i = 0; i < size; ++i)
+			getNearCallback()(pairs[i], *this, dispatchInfo);
+
+		ComputeBackend::get()->update(bodies);
 		
 		concurrency::parallel_for_each(shapes.begin(), shapes.end(), [](PerTriangleShape* shape) {
-			shape->m_verticesCollision->internalUpdate();
+			auto vertices = shape->m_verticesCollision();
+			if (vertices->m_skinVersion == shape->m_owner->m_skinVersion) return;
+
+			vertices->internalUpdate();
+			vertices->m_skinVersion = shape->m_owner->m_skinVersion;
 		});
 
+		m_pairContactBudget = SkinnedMeshAlgorithm::getPairContactBudget(m_pairs.size());
 		concurrency::parallel_for_each(m_pairs.begin(), m_pairs.end(), [&, this](const std::pair<SkinnedMeshBody*, SkinnedMeshBody*>& i) {
 			if (i.first->m_shape->m_tree.collapseCollideL(&i.second->m_shape->m_tree))
 				SkinnedMeshAlgorithm::processCollision(i.first, i.second, this);
 		});
 
 		m_pairs.clear();
+
+		for (auto i = m_pairCache.begin(); i != m_pairCache.end();)
+		{
+			if (i->second.used)
+			{
+				i->second.used = false;
+				++i;
+			}
+			else i = m_pairCache.erase(i);
+		}
+	}
+
+	ColliderPairCache* CollisionDispatcher::getPairCache(SkinnedMeshShape* shape0, SkinnedMeshShape* shape1)
+	{
+		HDT_LOCK_GUARD(l, m_pairCacheLock);
+		auto& ret = m_pairCache[std::make_pair(shape0, shape1)];
+		ret.used = true;
+		return &ret;
 	}
 
 	int CollisionDispatcher::getNumManifolds() const
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "hdtBulletHelper.h"
+#include "hdtCollider.h"
+#include "hdtBroadphase.h"
 #include <ppl.h>
 #include <ppltasks.h>
 #include <vector>
@@ -8,6 +10,8 @@
 namespace hdt
 {
 	class SkinnedMeshBody;
+	class SkinnedMeshShape;
+
 	class CollisionDispatcher : public btCollisionDispatcher
 	{
 	public:
@@ -38,7 +42,32 @@ namespace hdt
 
 		void clearAllManifold();
 
+		// entries not used in a dispatch are dropped at its end
+		ColliderPairCache* getPairCache(SkinnedMeshShape* shape0, SkinnedMeshShape* shape1);
+
+		SkinnedMeshBroadphase* m_broadphase = nullptr;	// set by the world, source of the body pairs
 		std::mutex m_lock;
+		int m_pairContactBudget = 0;	// contacts each colliding body pair may keep this step
 		std::vector<std::pair<SkinnedMeshBody*, SkinnedMeshBody*>> m_pairs;
+
+		// filled by each thread of the pair loop without locking, merged after it
+		struct GatherBuffer
+		{
+			std::vector<std::pair<SkinnedMeshBody*, SkinnedMeshBody*>> pairs;
+			std::vector<std::pair<SkinnedMeshBody*, Aabb>> regions;	// aabb the body has to be skinned for
+			std::vector<SkinnedMeshBody*> touched;	// sleeping bodies an awake one touched, woken in the serial merge
+		};
+		concurrency::combinable<GatherBuffer> m_gather;
+		U32 m_epoch = 0;	// bumped every dispatch
+
+		struct PairHash
+		{
+			size_t operator()(const std::pair<SkinnedMeshShape*, SkinnedMeshShape*>& p) const
+			{
+				return std::hash<void*>()(p.first) ^ (std::hash<void*>()(p.second) * 31);
+			}
+		};
+		SpinLock m_pairCacheLock;
+		std::unordered_map<std::pair<SkinnedMeshShape*, SkinnedMeshShape*>, ColliderPairCache, PairHash> m_pairCache;
 	};
 }
\ No newline at end of file
@@ -218,11 +218,15 @@ namespace hdt
 	{
 		auto ret = Base::solveGroupCacheFriendlySetup(bodies, numBodies, manifoldPtr, numManifolds, constraints, numConstraints, infoGlobal, debugDrawer);
 
-		concurrency::parallel_for_each(m_groups.begin(), m_groups.end(), [&](ConstraintGroup* i)
+		auto setupGroup = [&](ConstraintGroup* i)
 		{
 			i->setup(&m_tmpSolverBodyPool, infoGlobal);
 			i->iteration(bodies, numBodies, infoGlobal);
-		});
+		};
+		if (m_multithreaded)
+			concurrency::parallel_for_each(m_groups.begin(), m_groups.end(), setupGroup);
+		else
+			std::for_each(m_groups.begin(), m_groups.end(), setupGroup);
 
 		// init solver body
 		for (int j = 0; j < numConstraints; j++)
@@ -355,16 +359,24 @@ namespace hdt
 	btScalar GroupConstraintSolver::solveSingleIteration(int iteration, btCollisionObject** bodies, int numBodies, btPersistentManifold** manifoldPtr, int numManifolds, btTypedConstraint** constraints, int numConstraints, const btContactSolverInfo& infoGlobal, btIDebugDraw* debugDrawer)
 	{
 		int maxIterations = m_maxOverrideNumSolverIterations > infoGlobal.m_numIterations ? m_maxOverrideNumSolverIterations : infoGlobal.m_numIterations;
+		auto solveTasks = [this](std::vector<SolverTaskPtr>& tasks)
+		{
+			if (m_multithreaded)
+				concurrency::parallel_for_each(tasks.begin(), tasks.end(), [](const SolverTaskPtr& task) { task->solve(); });
+			else
+				for (auto& task : tasks) task->solve();
+		};
+
 		if (iteration <= (maxIterations * 3 + 3) / 4)
 		{
-			concurrency::parallel_for_each(m_tasks.begin(), m_tasks.end(), [](const SolverTaskPtr& task) { task->solve(); });
+			solveTasks(m_tasks);
 		}
 		else
 		{
 			std::random_shuffle(m_nonContactTasks.begin(), m_nonContactTasks.end());
 			std::random_shuffle(m_contactTasks.begin(), m_contactTasks.end());
-			concurrency::parallel_for_each(m_nonContactTasks.begin(), m_nonContactTasks.end(), [](const SolverTaskPtr& task) { task->solve(); });
-			concurrency::parallel_for_each(m_contactTasks.begin(), m_contactTasks.end(), [](const SolverTaskPtr& task) { task->solve(); });
+			solveTasks(m_nonContactTasks);
+			solveTasks(m_contactTasks);
 		}
 		return FLT_MAX;
 	}
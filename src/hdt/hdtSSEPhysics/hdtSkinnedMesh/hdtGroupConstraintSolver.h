@@ -93,6 +93,7 @@ namespace hdt
 		static btSingleConstraintRowSolver getResolveSingleConstraintRowGenericAVX();
 		static btSingleConstraintRowSolver getResolveSingleConstraintRowLowerLimitAVX();
 
+		bool								m_multithreaded = true;	// off when islands are already solved in parallel
 		std::vector<ConstraintGroup*>		m_groups;
 		std::vector<SolverBodyMt>			m_bodiesMt;
 		std::vector<btSolverConstraint*>	m_nonContactConstraintRowPtrs;
@@ -1,52 +1,92 @@
 #include "hdtSimulationIslandManager.h"
+#include "hdtSkinnedMeshBody.h"
+#include "hdtBoneScaleConstraint.h"
 
 namespace hdt
 {
-	void SimulationIslandManager::findUnions(btDispatcher* dispatcher, btCollisionWorld* colWorld)
+	void SimulationIslandManager::Island::clear()
 	{
+		m_bodies.clear();
+		m_manifolds.clear();
+		m_constraints.clear();
+		m_groups.clear();
+	}
 
+	void SimulationIslandManager::findUnions(btDispatcher* dispatcher, btCollisionWorld* colWorld)
+	{
+		// kinematic bones must merge too, a solver body can only live in one island
 		const int numOverlappingPairs = dispatcher->getNumManifolds();
-		if (numOverlappingPairs)
+		for (int i = 0; i < numOverlappingPairs; i++)
 		{
-			for (int i = 0; i<numOverlappingPairs; i++)
-			{
-				auto p = dispatcher->getInternalManifoldPointer()[i];
-				auto colObj0 = p->getBody0();
-				auto colObj1 = p->getBody1();
-
-				if ((colObj0 && (colObj0->mergesSimulationIslands())) &&
-					(colObj1 && (colObj1->mergesSimulationIslands())))
-				{
+			auto p = dispatcher->getInternalManifoldPointer()[i];
+			auto colObj0 = p->getBody0();
+			auto colObj1 = p->getBody1();
 
-					m_unionFind.unite(colObj0->getIslandTag(), colObj1->getIslandTag());
-				}
-			}
+			if (colObj0 && colObj1 && colObj0->getIslandTag() >= 0 && colObj1->getIslandTag() >= 0)
+				getUnionFind().unite(colObj0->getIslandTag(), colObj1->getIslandTag());
 		}
 	}
 
-	void SimulationIslandManager::updateActivationState(btCollisionWorld* colWorld, btDispatcher* dispatcher)
+	void SimulationIslandManager::buildIslands(const std::vector<Ref<SkinnedMeshSystem>>& systems, btCollisionWorld* colWorld, btDispatcher* dispatcher)
 	{
-		// put the index into m_controllers into m_tag   
-		int index = 0;
+		auto& objects = colWorld->getCollisionObjectArray();
+		for (int i = 0; i < objects.size(); ++i)
 		{
+			objects[i]->setIslandTag(-1);
+			objects[i]->setCompanionId(-1);
+			objects[i]->setHitFraction(btScalar(1.));
+		}
+
+		for (int i = 0; i < systems.size(); ++i)
+		{
+			for (auto& j : systems[i]->m_bones)
+				j->m_rig.setIslandTag(i);
+			for (auto& j : systems[i]->m_meshes)
+				j->setIslandTag(i);
+		}
 
-			int i;
-			for (i = 0; i<colWorld->getCollisionObjectArray().size(); i++)
+		initUnionFind(systems.size());
+		findUnions(dispatcher, colWorld);
+
+		m_numIslands = 0;
+		m_systemToIsland.assign(systems.size(), -1);
+		for (int i = 0; i < systems.size(); ++i)
+		{
+			auto system = systems[i]();
+			if (!system->isActive()) continue;
+
+			int root = getUnionFind().find(i);
+			if (m_systemToIsland[root] < 0)
+			{
+				if (m_islands.size() <= m_numIslands)
+					m_islands.resize(m_numIslands + 1);
+				m_islands[m_numIslands].clear();
+				m_systemToIsland[root] = m_numIslands++;
+			}
+
+			auto& island = m_islands[m_systemToIsland[root]];
+			for (auto& j : system->m_bones)
+				island.m_bodies.push_back(&j->m_rig);
+			for (auto& j : system->m_constraints)
+				island.m_constraints.push_back(j->m_constraint);
+			for (auto& j : system->m_constraintGroups)
 			{
-				btCollisionObject*   collisionObject = colWorld->getCollisionObjectArray()[i];
-				//Adding filtering here
-				if (!collisionObject->isStaticOrKinematicObject())
-				{
-					collisionObject->setIslandTag(index++);
-				}
-				collisionObject->setCompanionId(-1);
-				collisionObject->setHitFraction(btScalar(1.));
+				island.m_groups.push_back(j);
+				for (auto& k : j->m_constraints)
+					island.m_constraints.push_back(k->m_constraint);
 			}
 		}
-		// do the union find
 
-		initUnionFind(index);
+		const int numManifolds = dispatcher->getNumManifolds();
+		for (int i = 0; i < numManifolds; ++i)
+		{
+			auto p = dispatcher->getInternalManifoldPointer()[i];
+			int tag = p->getBody0()->getIslandTag() >= 0 ? p->getBody0()->getIslandTag() : p->getBody1()->getIslandTag();
+			if (tag < 0) continue;
 
-		findUnions(dispatcher, colWorld);
+			int island = m_systemToIsland[getUnionFind().find(tag)];
+			if (island >= 0)
+				m_islands[island].m_manifolds.push_back(p);
+		}
 	}
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hdtDispatcher.h"
+#include "hdtSkinnedMeshSystem.h"
 #include <BulletCollision\CollisionDispatch\btSimulationIslandManager.h>
 
 namespace hdt
@@ -8,9 +9,30 @@ namespace hdt
 	class SimulationIslandManager : public btSimulationIslandManager
 	{
 	public:
-		virtual void updateActivationState(btCollisionWorld* colWorld, btDispatcher* dispatcher);
+
+		struct Island
+		{
+			std::vector<btCollisionObject*>		m_bodies;
+			std::vector<btPersistentManifold*>	m_manifolds;
+			std::vector<btTypedConstraint*>		m_constraints;
+			std::vector<ConstraintGroup*>		m_groups;
+
+			void clear();
+		};
+
+		// one island per system, systems are merged only when their bodies are in contact
+		void buildIslands(const std::vector<Ref<SkinnedMeshSystem>>& systems, btCollisionWorld* colWorld, btDispatcher* dispatcher);
 
 		void findUnions(btDispatcher* dispatcher, btCollisionWorld* colWorld);
 		//void buildAndProcessIslands(btDispatcher* dispatcher, btCollisionWorld* collisionWorld, IslandCallback* callback);
+
+		inline int numIslands() const { return m_numIslands; }
+		inline Island& getIsland(int i) { return m_islands[i]; }
+
+	protected:
+
+		std::vector<Island> m_islands;
+		std::vector<int> m_systemToIsland;
+		int m_numIslands = 0;
 	};
-}
\ No newline at end of file
+}
@@ -1,6 +1,8 @@
 #include "hdtSkinnedMeshAlgorithm.h"
 #include "hdtCollider.h"
 
+#include <memory>
+
 namespace hdt
 {
 
@@ -11,63 +13,143 @@ namespace hdt
 	
 	static const CollisionResult zero;
 
+	int SkinnedMeshAlgorithm::PairContactBudget = 256;
+	int SkinnedMeshAlgorithm::MinPairContactBudget = 16;
+	int SkinnedMeshAlgorithm::StepContactBudget = 0;
+
+	int SkinnedMeshAlgorithm::getPairContactBudget(size_t numPairs)
+	{
+		if (StepContactBudget <= 0 || !numPairs)
+			return PairContactBudget;
+
+		auto share = static_cast<int>(StepContactBudget / numPairs);
+		return std::min(PairContactBudget, std::max(share, MinPairContactBudget));
+	}
+
+	// more negative is more important, contacts that can't move anything are worth nothing
+	static inline float contactPriority(const CollisionResult& res)
+	{
+		return res.depth * std::max(res.colliderA->flexible, res.colliderB->flexible);
+	}
+
+	// strict order on contacts so the kept set doesn't depend on which task finished first
+	static inline bool higherPriority(const CollisionResult& a, const CollisionResult& b)
+	{
+		auto pa = contactPriority(a);
+		auto pb = contactPriority(b);
+		if (pa != pb) return pa < pb;
+		if (a.colliderA != b.colliderA) return a.colliderA < b.colliderA;
+		return a.colliderB < b.colliderB;
+	}
+
 	template<class T0, class T1>
 	struct CollisionCheck
 	{
 		typedef typename T0::ShapeProp SP0;
 		typedef typename T1::ShapeProp SP1;
 
-		CollisionCheck(T0* a, T1* b, CollisionResult* r)
+		CollisionCheck(T0* a, T1* b, CollisionResult* r, int budget, ColliderPairCache* cache)
 		{
+			version0 = a->m_fatVersion;
+			version1 = b->m_fatVersion;
+			this->cache = cache;
 			v0 = a->m_owner->m_vpos.data();
 			v1 = b->m_owner->m_vpos.data();
+			prev0 = a->m_continuous ? a->m_owner->m_vposPrev.data() : nullptr;
+			prev1 = b->m_continuous ? b->m_owner->m_vposPrev.data() : nullptr;
 			c0 = &a->m_tree;
 			c1 = &b->m_tree;
+			aabb0 = a->m_aabb.data();
+			aabb1 = b->m_aabb.data();
+			soa0 = &a->m_aabbSoA;
+			soa1 = &b->m_aabbSoA;
 			sp0 = &a->m_shapeProp;
 			sp1 = &b->m_shapeProp;
 			results = r;
 			numResults = 0;
+			this->budget = budget;
 		}
 
 		VertexPos* v0;
 		VertexPos* v1;
+		VertexPos* prev0;	// previous positions of continuous shapes
+		VertexPos* prev1;
 		ColliderTree* c0;
 		ColliderTree* c1;
+		Aabb* aabb0;
+		Aabb* aabb1;
+		AabbSoA* soa0;
+		AabbSoA* soa1;
 		SP0* sp0;
 		SP1* sp1;
+		U32 version0;
+		U32 version1;
+		ColliderPairCache* cache;
 
-		std::atomic_long numResults;
-		CollisionResult* results;
+		int numResults;
+		int budget;
+		CollisionResult* results;	// max heap on priority while collecting, the least important on top
+
+		// bounded heap of one task, merged into results once the node pairs are done
+		struct LocalResults
+		{
+			std::vector<CollisionResult> results;
+			int numResults = 0;
+		};
 
 		bool checkCollide(Collider* a, Collider* b, CollisionResult& res);
+
+		// sphere / triangle pairs go through SphereTriangleBatch, checkCollide only runs for the deepest of a node pair
+		static constexpr bool Batched = !std::is_same<T0, T1>::value;
+		void addCandidate(Collider* a, Collider* b, SphereTriangleBatch& batch);
+
+		// continuous shapes sweep spheres that moved further than their radius since the last step
+		bool isSwept(Collider* a, Collider* b);
+		bool checkCollideSwept(Collider* a, Collider* b, CollisionResult& res);
 		
-		bool addResult(const CollisionResult& res)
+		bool addResult(CollisionResult* heap, int& size, const CollisionResult& res) const
 		{
-			int p = numResults.fetch_add(1);
-			if (p < SkinnedMeshAlgorithm::MaxCollisionCount)
+			if (contactPriority(res) >= -FLT_EPSILON)
+				return false;
+
+			if (size < budget)
 			{
-				results[p] = res;
-				return true;
+				heap[size++] = res;
+				std::push_heap(heap, heap + size, higherPriority);
+			}
+			else if (higherPriority(res, heap[0]))
+			{
+				std::pop_heap(heap, heap + size, higherPriority);
+				heap[size - 1] = res;
+				std::push_heap(heap, heap + size, higherPriority);
 			}
 			else return false;
+			return true;
 		}
 
 		int operator()()
 		{
-			std::vector<std::pair<ColliderTree*, ColliderTree*>> pairs;
-			pairs.reserve(c0->colliders.size() + c1->colliders.size());
-			c0->checkCollisionL(c1, pairs);
+			// both trees kept their fat bounds since the last traversal, the pairs found then still cover every overlap
+			auto& pairs = cache->pairs;
+			if (cache->version0 != version0 || cache->version1 != version1)
+			{
+				pairs.clear();
+				c0->checkCollisionL(c1, pairs);
+				cache->version0 = version0;
+				cache->version1 = version1;
+			}
 			if (pairs.empty()) return 0;
 
-			decltype(auto) func = [this](const std::pair<ColliderTree*, ColliderTree*>& pair)
+			// deepest contact of a node pair, false if there is none
+			decltype(auto) func = [this](const std::pair<ColliderTree*, ColliderTree*>& pair, CollisionResult& result)
 			{
-				if (numResults >= SkinnedMeshAlgorithm::MaxCollisionCount)
-					return;
-
 				auto a = pair.first, b = pair.second;
 
 				auto aabbA = a->aabbMe;
 				auto aabbB = b->aabbMe;
+				if (!aabbA.collideWith(aabbB))
+					return false;
+
 				auto abeg = a->aabb;
 				auto bbeg = b->aabb;
 				auto asize = b->isKinematic ? a->dynCollider : a->numCollider;
@@ -75,87 +157,139 @@ namespace hdt
 				auto aend = abeg + asize;
 				auto bend = bbeg + bsize;
 
-				CollisionResult result;
 				CollisionResult temp;
 				bool hasResult = false;
-
-				// std::string(MSVC implements) has a small internal buffer which decreased memory allocations 
-				thread_local std::vector<Aabb*> list;
-				if (asize > bsize)
+				thread_local SphereTriangleBatch batch;
+				thread_local std::vector<std::pair<Collider*, Collider*>> batchPairs;
+				auto test = [&](Collider* ca, Collider* cb)
 				{
-					list.reserve(std::max<size_t>(bsize, list.capacity()));
-					for (auto i = bbeg; i < bend; ++i)
+					bool hit;
+					if (isSwept(ca, cb))
+						hit = checkCollideSwept(ca, cb, temp);
+					else if (Batched)
 					{
-						if (i->collideWith(aabbA))
-							list.push_back(i);
+						addCandidate(ca, cb, batch);
+						batchPairs.push_back(std::make_pair(ca, cb));
+						return;
 					}
+					else hit = checkCollide(ca, cb, temp);
 
-					for (auto i = abeg; i < aend; ++i)
+					if (hit)
 					{
-						//if (numResults >= SkinnedMeshAlgorithm::MaxCollisionCount)
-						//	break;
+						if (!hasResult || result.depth > temp.depth)
+						{
+							hasResult = true;
+							result = temp;
+						}
+					}
+				};
 
-						if (!i->collideWith(aabbB))
-							continue;
+				// colliders of the smaller side overlapping the other node are packed once,
+				// then each collider of the bigger side is tested against Width of them at a time
+				thread_local AabbSoA list;
+				thread_local std::vector<U32> listIdx;
+				auto filter = [](const AabbSoA& soa, size_t begin, size_t size, const Aabb& bound)
+				{
+					list.clear();
+					listIdx.clear();
+					for (size_t j = 0; j < size; j += AabbSoA::Width)
+					{
+						unsigned long k;
+						U32 mask = soa.collideMask(begin + j, bound) & AabbSoA::tailMask(size - j);
+						while (_BitScanForward(&k, mask))
+						{
+							mask &= mask - 1;
+							list.push_back(soa.get(begin + j + k));
+							listIdx.push_back(static_cast<U32>(j + k));
+						}
+					}
+				};
+				auto forEachListed = [](const Aabb& aabb, auto&& func)
+				{
+					for (size_t j = 0; j < list.size(); j += AabbSoA::Width)
+					{
+						unsigned long k;
+						U32 mask = list.collideMask(j, aabb) & AabbSoA::tailMask(list.size() - j);
+						while (_BitScanForward(&k, mask))
+						{
+							mask &= mask - 1;
+							func(listIdx[j + k]);
+						}
+					}
+				};
 
-						for (auto j : list)
+				if (asize > bsize)
+				{
+					filter(*soa1, bbeg - aabb1, bsize, aabbA);
+					if (list.size())
+					{
+						for (auto i = abeg; i < aend; ++i)
 						{
-							if (!i->collideWith(*j))
+							if (!i->collideWith(aabbB))
 								continue;
-							if (checkCollide(&a->cbuf[i - abeg], &b->cbuf[j - bbeg], temp))
-							{
-								if (!hasResult || result.depth > temp.depth)
-								{
-									hasResult = true;
-									result = temp;
-								}
-							}
+							auto ca = &a->cbuf[i - abeg];
+							forEachListed(*i, [&](U32 j) { test(ca, &b->cbuf[j]); });
 						}
 					}
 				}
 				else
 				{
-					list.reserve(std::max<size_t>(bsize, list.capacity()));
-					for (auto i = abeg; i < aend; ++i)
-					{
-						if (i->collideWith(aabbB))
-							list.push_back(i);
-					}
-
-					for (auto j = bbeg; j < bend; ++j)
+					filter(*soa0, abeg - aabb0, asize, aabbB);
+					if (list.size())
 					{
-						//if (numResults >= SkinnedMeshAlgorithm::MaxCollisionCount)
-						//	break;
-
-						if (!j->collideWith(aabbA))
-							continue;
-
-						for (auto i : list)
+						for (auto j = bbeg; j < bend; ++j)
 						{
-							if (!i->collideWith(*j))
+							if (!j->collideWith(aabbA))
 								continue;
-							if (checkCollide(&a->cbuf[i - abeg], &b->cbuf[j - bbeg], temp))
-							{
-								if (!hasResult || result.depth > temp.depth)
-								{
-									hasResult = true;
-									result = temp;
-								}
-							}
+							auto cb = &b->cbuf[j - bbeg];
+							forEachListed(*j, [&](U32 i) { test(&a->cbuf[i], cb); });
 						}
 					}
 				}
-				list.clear();
 
-				if (hasResult)
+				if (batch.size())
 				{
-					addResult(result);
+					int i = batch.deepest();
+					if (i >= 0 && checkCollide(batchPairs[i].first, batchPairs[i].second, temp))
+					{
+						if (!hasResult || result.depth > temp.depth)
+						{
+							hasResult = true;
+							result = temp;
+						}
+					}
+					batch.clear();
+					batchPairs.clear();
 				}
+
+				return hasResult;
 			};
 
 			if (pairs.size() >= std::thread::hardware_concurrency())
-				concurrency::parallel_for_each(pairs.begin(), pairs.end(), func);
-			else for (auto& i : pairs) func(i);
+			{
+				concurrency::combinable<LocalResults> local;
+				concurrency::parallel_for_each(pairs.begin(), pairs.end(), [&](const std::pair<ColliderTree*, ColliderTree*>& i) {
+					CollisionResult result;
+					if (!func(i, result)) return;
+
+					auto& heap = local.local();
+					if (heap.results.empty())
+						heap.results.resize(budget);
+					addResult(heap.results.data(), heap.numResults, result);
+				});
+
+				// the order is strict, so the kept set is the same whichever heap a contact went through
+				local.combine_each([this](LocalResults& heap) {
+					for (int i = 0; i < heap.numResults; ++i)
+						addResult(results, numResults, heap.results[i]);
+				});
+			}
+			else for (auto& i : pairs)
+			{
+				CollisionResult result;
+				if (func(i, result))
+					addResult(results, numResults, result);
+			}
 			//if (pairs.size() >= 4)
 			//{
 			//	concurrency::task_group taskGroup;
@@ -165,10 +299,102 @@ namespace hdt
 			//}
 			//else for (auto& i : pairs) func(i);
 
+			// most important first
+			std::sort_heap(results, results + numResults, higherPriority);
 			return numResults;
 		}
 	};
 
+	template<> void CollisionCheck<PerVertexShape, PerVertexShape>::addCandidate(Collider* a, Collider* b, SphereTriangleBatch& batch)
+	{
+		// sphere pairs are never batched
+	}
+
+	template<> void CollisionCheck<PerVertexShape, PerTriangleShape>::addCandidate(Collider* a, Collider* b, SphereTriangleBatch& batch)
+	{
+		auto s = v0[a->vertex];
+		auto p0 = v1[b->vertices[0]];
+		auto p1 = v1[b->vertices[1]];
+		auto p2 = v1[b->vertices[2]];
+		auto margin = (p0.marginMultiplier() + p1.marginMultiplier() + p2.marginMultiplier()) / 3;
+		batch.add(s.pos(), s.marginMultiplier() * sp0->margin, p0.pos(), p1.pos(), p2.pos(), margin * sp1->margin, sp1->penetration * margin);
+	}
+
+	template<> void CollisionCheck<PerTriangleShape, PerVertexShape>::addCandidate(Collider* a, Collider* b, SphereTriangleBatch& batch)
+	{
+		auto s = v1[b->vertex];
+		auto p0 = v0[a->vertices[0]];
+		auto p1 = v0[a->vertices[1]];
+		auto p2 = v0[a->vertices[2]];
+		auto margin = (p0.marginMultiplier() + p1.marginMultiplier() + p2.marginMultiplier()) / 3;
+		batch.add(s.pos(), s.marginMultiplier() * sp1->margin, p0.pos(), p1.pos(), p2.pos(), margin * sp0->margin, sp0->penetration * margin);
+	}
+
+	static inline bool sphereMoved(const VertexPos* prev, const VertexPos& cur, float radius)
+	{
+		return prev && (cur.pos() - prev->pos()).length2() > radius * radius;
+	}
+
+	template<> bool CollisionCheck<PerVertexShape, PerVertexShape>::isSwept(Collider* a, Collider* b)
+	{
+		return false;
+	}
+
+	template<> bool CollisionCheck<PerVertexShape, PerTriangleShape>::isSwept(Collider* a, Collider* b)
+	{
+		auto& s = v0[a->vertex];
+		return sphereMoved(prev0 ? &prev0[a->vertex] : nullptr, s, s.marginMultiplier() * sp0->margin);
+	}
+
+	template<> bool CollisionCheck<PerTriangleShape, PerVertexShape>::isSwept(Collider* a, Collider* b)
+	{
+		auto& s = v1[b->vertex];
+		return sphereMoved(prev1 ? &prev1[b->vertex] : nullptr, s, s.marginMultiplier() * sp1->margin);
+	}
+
+	template<> bool CollisionCheck<PerVertexShape, PerVertexShape>::checkCollideSwept(Collider* a, Collider* b, CollisionResult& res)
+	{
+		return false;	// never swept
+	}
+
+	template<> bool CollisionCheck<PerVertexShape, PerTriangleShape>::checkCollideSwept(Collider* a, Collider* b, CollisionResult& res)
+	{
+		auto s = v0[a->vertex];
+		auto r = s.marginMultiplier() * sp0->margin;
+		auto p0 = v1[b->vertices[0]];
+		auto p1 = v1[b->vertices[1]];
+		auto p2 = v1[b->vertices[2]];
+		auto margin = (p0.marginMultiplier() + p1.marginMultiplier() + p2.marginMultiplier()) / 3;
+		auto penetration = sp1->penetration * margin;
+		margin *= sp1->margin;
+
+		CheckTriangle tri(p0.pos(), p1.pos(), p2.pos(), margin, penetration);
+		if (!tri.valid) return false;
+		auto ret = checkSphereTriangle(prev0[a->vertex].pos(), s.pos(), r, tri, res);
+		res.colliderA = a;
+		res.colliderB = b;
+		return ret;
+	}
+
+	template<> bool CollisionCheck<PerTriangleShape, PerVertexShape>::checkCollideSwept(Collider* a, Collider* b, CollisionResult& res)
+	{
+		auto s = v1[b->vertex];
+		auto r = s.marginMultiplier() * sp1->margin;
+		auto p0 = v0[a->vertices[0]];
+		auto p1 = v0[a->vertices[1]];
+		auto p2 = v0[a->vertices[2]];
+		auto margin = (p0.marginMultiplier() + p1.marginMultiplier() + p2.marginMultiplier()) / 3;
+		auto penetration = sp0->penetration * margin;
+		margin *= sp0->margin;
+
+		CheckTriangle tri(p0.pos(), p1.pos(), p2.pos(), margin, penetration);
+		if (!tri.valid) return false;
+		auto ret = checkTriangleSphere(prev1[b->vertex].pos(), s.pos(), r, tri, res);
+		res.colliderA = a;
+		res.colliderB = b;
+		return ret;
+	}
+
 	template<> bool CollisionCheck<PerVertexShape, PerVertexShape>::checkCollide(Collider* a, Collider* b, CollisionResult& res)
 	{
 		auto s0 = v0[a->vertex];
@@ -220,9 +446,70 @@ namespace hdt
 		return ret;
 	}
 
-	template<class T0, class T1> inline int checkCollide(T0* a, T1* b, CollisionResult* results)
+	template<class T0, class T1> inline int checkCollide(T0* a, T1* b, CollisionResult* results, int budget, ColliderPairCache* cache)
+	{
+		return CollisionCheck<T0, T1>(a, b, results, budget, cache)();
+	}
+
+	void SkinnedMeshAlgorithm::MergeBuffer::reset()
+	{
+		for (auto i : touched)
+			keys[i] = Empty;
+		touched.clear();
+		merges.clear();
+	}
+
+	static inline U32 mergeSlot(U32 key, U32 mask)
+	{
+		return (key * 2654435761U) & mask;
+	}
+
+	SkinnedMeshAlgorithm::CollisionMerge* SkinnedMeshAlgorithm::MergeBuffer::get(int x, int y)
 	{
-		return CollisionCheck<T0, T1>(a, b, results)();
+		if ((merges.size() + 1) * 2 > keys.size())
+			grow();
+
+		U32 key = (static_cast<U32>(x) << 16) | static_cast<U32>(y);
+		U32 mask = static_cast<U32>(keys.size()) - 1;
+		for (U32 i = mergeSlot(key, mask);; i = (i + 1) & mask)
+		{
+			if (keys[i] == key)
+				return &merges[indices[i]];
+
+			if (keys[i] == Empty)
+			{
+				keys[i] = key;
+				indices[i] = static_cast<U32>(merges.size());
+				touched.push_back(i);
+
+				merges.emplace_back();
+				auto ret = &merges.back();
+				ret->bone0 = x;
+				ret->bone1 = y;
+				return ret;
+			}
+		}
+	}
+
+	void SkinnedMeshAlgorithm::MergeBuffer::grow()
+	{
+		auto size = std::max<size_t>(64, keys.size() * 2);
+		keys.assign(size, Empty);
+		indices.resize(size);
+		touched.clear();
+
+		U32 mask = static_cast<U32>(size) - 1;
+		for (U32 j = 0; j < merges.size(); ++j)
+		{
+			U32 key = (static_cast<U32>(merges[j].bone0) << 16) | static_cast<U32>(merges[j].bone1);
+			U32 i = mergeSlot(key, mask);
+			while (keys[i] != Empty)
+				i = (i + 1) & mask;
+
+			keys[i] = key;
+			indices[i] = j;
+			touched.push_back(i);
+		}
 	}
 
 	void SkinnedMeshAlgorithm::MergeBuffer::doMerge(SkinnedMeshShape* a, SkinnedMeshShape* b, CollisionResult* collision, int count)
@@ -230,10 +517,7 @@ namespace hdt
 		for (int i = 0; i < count; ++i)
 		{
 			auto& res = collision[i];
-			if (res.depth >= -FLT_EPSILON) break;
-
 			auto flexible = std::max(res.colliderA->flexible, res.colliderB->flexible);
-			if (flexible < FLT_EPSILON) return;
 
 			for (int ib = 0; ib < a->getBonePerCollider(); ++ib)
 			{
@@ -261,75 +545,92 @@ namespace hdt
 			}
 		}
 	}
+
 	void SkinnedMeshAlgorithm::MergeBuffer::apply(SkinnedMeshBody* body0, SkinnedMeshBody* body1, CollisionDispatcher* dispatcher)
 	{
-		for (int i = 0; i < body0->m_skinnedBones.size(); ++i)
+		for (auto& merge : merges)
 		{
-			if (!body1->canCollideWith(body0->m_skinnedBones[i].ptr)) continue;
-			for (int j = 0; j < body1->m_skinnedBones.size(); ++j)
-			{
-				if (!body0->canCollideWith(body1->m_skinnedBones[j].ptr)) continue;
-				if (get(i, j)->weight < FLT_EPSILON) continue;
-
-				if (body0->m_skinnedBones[i].isKinematic && body1->m_skinnedBones[j].isKinematic) continue;
-
-				auto rb0 = body0->m_skinnedBones[i].ptr;
-				auto rb1 = body1->m_skinnedBones[j].ptr;
-				if (rb0 == rb1) continue;
-
-				auto c = get(i, j);
-				float invWeight = 1.0f / c->weight;
-
-				auto maniford = dispatcher->getNewManifold(&rb0->m_rig, &rb1->m_rig);
-				auto worldA = c->pos[0] * invWeight;
-				auto worldB = c->pos[1] * invWeight;
-				auto localA = rb0->m_rig.getWorldTransform().invXform(worldA);
-				auto localB = rb1->m_rig.getWorldTransform().invXform(worldB);
-				auto normal = c->normal * invWeight;
-				if (normal.fuzzyZero()) continue;
-				auto depth = -normal.length();
-				normal = -normal.normalized();
-
-				if (depth >= -FLT_EPSILON) continue;
-
-				btManifoldPoint newPt(localA, localB, normal, depth);
-				newPt.m_positionWorldOnA = worldA;
-				newPt.m_positionWorldOnB = worldB;
-				newPt.m_combinedFriction = rb0->m_rig.getFriction() * rb1->m_rig.getFriction();
-				newPt.m_combinedRestitution = rb0->m_rig.getRestitution() * rb1->m_rig.getRestitution();
-				newPt.m_combinedRollingFriction = rb0->m_rig.getRollingFriction() * rb1->m_rig.getRollingFriction();
-				maniford->addManifoldPoint(newPt);
-			}
+			int i = merge.bone0;
+			int j = merge.bone1;
+			if (merge.weight < FLT_EPSILON) continue;
+
+			if (body0->m_skinnedBones[i].isKinematic && body1->m_skinnedBones[j].isKinematic) continue;
+
+			auto rb0 = body0->m_skinnedBones[i].ptr;
+			auto rb1 = body1->m_skinnedBones[j].ptr;
+			if (rb0 == rb1) continue;
+
+			if (!body1->canCollideWith(rb0) || !body0->canCollideWith(rb1)) continue;
+
+			auto c = &merge;
+			float invWeight = 1.0f / c->weight;
+
+			auto maniford = dispatcher->getNewManifold(&rb0->m_rig, &rb1->m_rig);
+			auto worldA = c->pos[0] * invWeight;
+			auto worldB = c->pos[1] * invWeight;
+			auto localA = rb0->m_rig.getWorldTransform().invXform(worldA);
+			auto localB = rb1->m_rig.getWorldTransform().invXform(worldB);
+			auto normal = c->normal * invWeight;
+			if (normal.fuzzyZero()) continue;
+			auto depth = -normal.length();
+			normal = -normal.normalized();
+
+			if (depth >= -FLT_EPSILON) continue;
+
+			btManifoldPoint newPt(localA, localB, normal, depth);
+			newPt.m_positionWorldOnA = worldA;
+			newPt.m_positionWorldOnB = worldB;
+			newPt.m_combinedFriction = rb0->m_rig.getFriction() * rb1->m_rig.getFriction();
+			newPt.m_combinedRestitution = rb0->m_rig.getRestitution() * rb1->m_rig.getRestitution();
+			newPt.m_combinedRollingFriction = rb0->m_rig.getRollingFriction() * rb1->m_rig.getRollingFriction();
+			maniford->addManifoldPoint(newPt);
 		}
 	}
 
-	template<class T0, class T1> void SkinnedMeshAlgorithm::processCollision(T0* shape0, T1* shape1, MergeBuffer& merge, CollisionResult* collision)
+	template<class T0, class T1> int SkinnedMeshAlgorithm::processCollision(T0* shape0, T1* shape1, MergeBuffer& merge, int budget, CollisionDispatcher* dispatcher)
 	{
-		int count = std::min(checkCollide(shape0, shape1, collision), MaxCollisionCount);
+		auto collision = merge.results.data();
+		int count = checkCollide(shape0, shape1, collision, budget, dispatcher->getPairCache(shape0, shape1));
 		if (count > 0)
 			merge.doMerge(shape0, shape1, collision, count);
+		return count;
 	}
 
 	void SkinnedMeshAlgorithm::processCollision(SkinnedMeshBody* body0, SkinnedMeshBody* body1, CollisionDispatcher* dispatcher)
 	{
-		MergeBuffer merge;
-		merge.alloc(body0->m_skinnedBones.size(), body1->m_skinnedBones.size());
+		// ppl may run another body pair on this thread while the narrowphase waits, so buffers are pooled instead of
+		// being a single thread_local
+		thread_local std::vector<std::unique_ptr<MergeBuffer>> pool;
+		std::unique_ptr<MergeBuffer> buffer;
+		if (pool.empty())
+			buffer.reset(new MergeBuffer);
+		else
+		{
+			buffer = std::move(pool.back());
+			pool.pop_back();
+		}
+		auto& merge = *buffer;
+
+		int budget = dispatcher->m_pairContactBudget;
+		if (merge.results.size() < static_cast<size_t>(budget))
+			merge.results.resize(budget);
 
-		auto collision = new CollisionResult[MaxCollisionCount];
 		if (body0->m_shape->asPerTriangleShape() && body1->m_shape->asPerTriangleShape())
 		{
-			processCollision(body0->m_shape->asPerTriangleShape(), body1->m_shape->asPerVertexShape(), merge, collision);
-			processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerTriangleShape(), merge, collision);
+			// both directions share the pair's budget, the second gets whatever the first left
+			int count = processCollision(body0->m_shape->asPerTriangleShape(), body1->m_shape->asPerVertexShape(), merge, (budget + 1) / 2, dispatcher);
+			if (budget > count)
+				processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerTriangleShape(), merge, budget - count, dispatcher);
 		}
 		else if (body0->m_shape->asPerTriangleShape())
-			processCollision(body0->m_shape->asPerTriangleShape(), body1->m_shape->asPerVertexShape(), merge, collision);
+			processCollision(body0->m_shape->asPerTriangleShape(), body1->m_shape->asPerVertexShape(), merge, budget, dispatcher);
 		else if (body1->m_shape->asPerTriangleShape())
-			processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerTriangleShape(), merge, collision);
-		else processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerVertexShape(), merge, collision);
+			processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerTriangleShape(), merge, budget, dispatcher);
+		else processCollision(body0->m_shape->asPerVertexShape(), body1->m_shape->asPerVertexShape(), merge, budget, dispatcher);
 
-		delete[] collision;
 		merge.apply(body0, body1, dispatcher);
-		merge.release();
+		merge.reset();
+		pool.push_back(std::move(buffer));
 	}
 
 	void SkinnedMeshAlgorithm::registerAlgorithm(btCollisionDispatcher * dispatcher)
@@ -25,7 +25,13 @@ namespace hdt
 
 		static void registerAlgorithm(btCollisionDispatcher * dispatcher);
 
-		static const int MaxCollisionCount = 256;
+		// contacts kept per shape pair, the deepest weighted by flexibility win. the step budget is shared
+		// evenly by all colliding body pairs of a step but never lowers a pair below MinPairContactBudget
+		static int PairContactBudget;
+		static int MinPairContactBudget;
+		static int StepContactBudget;	// 0 for no step budget
+
+		static int getPairContactBudget(size_t numPairs);
 
 		static void processCollision(SkinnedMeshBody* body0Wrap, SkinnedMeshBody* body1Wrap, CollisionDispatcher* dispatcher);
 	protected:
@@ -35,6 +41,8 @@ namespace hdt
 			btVector3 normal;
 			btVector3 pos[2];
 			float weight;
+			int bone0;
+			int bone1;
 
 			inline CollisionMerge()
 			{
@@ -45,27 +53,29 @@ namespace hdt
 			}
 		};
 
+		// bone pairs touched by the contacts of a body pair, open addressed on (bone0, bone1).
+		// one per thread, storage is kept between body pairs and only touched slots are cleared
 		struct MergeBuffer
 		{
-			MergeBuffer(){ mergeStride = mergeSize = 0; buffer = 0; }
-
-			inline CollisionMerge* begin() const { return buffer; }
-			inline CollisionMerge* end() const { return buffer + mergeSize; }
+			void reset();
 
-			void alloc(int x, int y){ mergeStride = y; mergeSize = x*y; buffer = new CollisionMerge[mergeSize]; }
-			void release(){ if (buffer) delete[] buffer; }
-			
-			CollisionMerge* get(int x, int y){ return &buffer[x * mergeStride + y]; }
+			CollisionMerge* get(int x, int y);
 
 			void doMerge(SkinnedMeshShape* shape0, SkinnedMeshShape* shape1, CollisionResult* collisions, int count);
 			void apply(SkinnedMeshBody* body0, SkinnedMeshBody* body1, CollisionDispatcher* dispatcher);
-			
-			int mergeStride;
-			int mergeSize;
-			CollisionMerge* buffer;
+
+			static const U32 Empty = ~0U;
+
+			void grow();
+
+			std::vector<U32> keys;
+			std::vector<U32> indices;			// into merges, per slot
+			std::vector<U32> touched;			// slots to clear in reset
+			vectorA16<CollisionMerge> merges;	// in first touch order
+			vectorA16<CollisionResult> results;	// narrowphase output, at least the pair budget long
 		};
 
-		template<class T0, class T1> static void processCollision(T0* shape0, T1* shape1, MergeBuffer& merge, CollisionResult* collision);
+		template<class T0, class T1> static int processCollision(T0* shape0, T1* shape1, MergeBuffer& merge, int budget, CollisionDispatcher* dispatcher);	// returns the contacts kept
 	};
 
 }
\ No newline at end of file
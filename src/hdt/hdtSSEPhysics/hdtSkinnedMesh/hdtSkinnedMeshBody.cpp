@@ -1,148 +1,307 @@
 #include "hdtSkinnedMeshBody.h"
 #include "hdtSkinnedMeshShape.h"
+#include "hdtComputeBackend.h"
 
 #include <ppl.h>
+#include <mutex>
+#include <unordered_map>
+#include <intrin.h>
+#include <LinearMath/btCpuFeatureUtility.h>
 
 namespace hdt
 {
-#ifdef ENABLE_CL
-
-	static std::string sourceCode = R"__KERNEL(
-typedef struct Matrix4x3
-{
-	float4 r[3];
-} Matrix4x3;
-
-float4 mul(Matrix4x3 a, float4 b)
-{
-	float4 ret = {dot(a.r[0], b), dot(a.r[1], b), dot(a.r[2], b), 1};
-	return ret;
-}
-
-typedef struct Vertex
-{
-	float4 skinPos;
-	float weight[4];
-	uint boneIdx[4];
-} Vertex;
+	SkinnedMeshBody::SkinnedMeshBody()
+	{
+		m_collisionShape = &m_bulletShape;
+		m_internalType = InternalType;
+	}
 
-typedef struct Bone
-{
-	Matrix4x3	t;
-	float		margin;
-	float		reserved[3];
-}Bone;
-
-__kernel void updateVertices(
-	__global Bone* bones,
-	__global Vertex* vertices,
-	__global float4* out)
-{
-	int idx = get_global_id(0);
-	Vertex v = vertices[idx];
-	float4 pos = 0;
-	for(int i=0; i<4; ++i)
+	SkinnedMeshBody::~SkinnedMeshBody()
 	{
-		if(v.weight[i] > FLT_EPSILON)
-		{
-			float4 p = {v.skinPos.x, v.skinPos.y, v.skinPos.z, 1};
-			p = mul(bones[v.boneIdx[i]].t, p);
-			p.w = bones[v.boneIdx[i]].margin;
-			p *= v.weight[i];
-			pos += p;
-		}
+		ComputeBackend::get()->release(this);
 	}
-	out[idx] = pos;
-}
-	)__KERNEL";
 
-	hdtCLKernel SkinnedMeshBody::m_kernel;
+	__forceinline __m128 calcVertexState(__m128 skinPos, const Bone& bone, __m128 w)
+	{
+		auto p = bone.m_vertexToWorld * skinPos;
+		p = _mm_blend_ps(p.get128(), _mm_load_ps(bone.m_reserved), 0x8);
+		return _mm_mul_ps(w, p.get128());
+	}
 
-	void SkinnedMeshBody::internalUpdateCL()
+	// a single vertex from its stream slot, decoded like the wide kernel and the clusters do so every path gives the same result
+	static void skinVertex(const Bone* bones, const VertexStream& stream, U32 vertex, VertexPos* out)
 	{
-		for (int i = 0; i < m_skinnedBones.size(); ++i)
+		auto& slot = stream.m_slots[vertex];
+		__m128 p, w;
+		U32 boneIdx[4];
+		if (slot.m_cluster == VertexStream::Unclustered)
 		{
-			auto boneT = m_skinnedBones[i]->m_currentTransform;
-			m_bones[i].m_vertexToWorld = boneT * m_vertexToBone[i];
-			m_bones[i].m_maginMultipler = m_skinnedBones[i]->m_marginMultipler * boneT.getScale();
+			U32 i = slot.m_index;
+			auto q = _mm_set_ps(0, stream.m_skinPos[2][i], stream.m_skinPos[1][i], stream.m_skinPos[0][i]);
+			p = _mm_add_ps(_mm_mul_ps(q, stream.m_posScale.get128()), stream.m_posMin.get128());
+			w = _mm_mul_ps(_mm_set_ps(stream.m_weight[3][i], stream.m_weight[2][i], stream.m_weight[1][i], stream.m_weight[0][i]), _mm_set_ps1(1.0f / 65535));
+			for (int j = 0; j < 4; ++j)
+				boneIdx[j] = stream.m_boneIdx[j][i];
 		}
-
-		auto cl = hdtCL::instance();
-		if (cl && !m_bonesCL())
+		else
 		{
-			m_bonesCL = cl->createBuffer(sizeof(Bone)* m_bones.size(), CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, nullptr);
-			m_verticesCL = cl->createBuffer(sizeof(Vertex)* m_vertices.size(), CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, nullptr);
-			m_vposCL = cl->createBuffer(sizeof(VertexPos)* m_vpos.size(), CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, nullptr);
-			cl->writeBuffer(m_verticesCL, m_vertices.data(), sizeof(Vertex)* m_vertices.size(), true);
+			auto& c = stream.m_clusters[slot.m_cluster];
+			p = c.m_skinPos[slot.m_index].get128();
+			w = _mm_loadu_ps(c.m_weight);
+			for (int j = 0; j < 4; ++j)
+				boneIdx[j] = c.m_boneIdx[j];
 		}
 
-		auto e0 = cl->writeBufferE(m_bonesCL, m_bones.data(), m_bones.size() * sizeof(Bone));
-		m_kernel.setArg(0, m_bonesCL);
-		m_kernel.setArg(1, m_verticesCL);
-		m_kernel.setArg(2, m_vposCL);
-		auto e1 = m_kernel.runE({ m_vertices.size() }, { e0 });
-		m_eDoneCL = cl->readBufferE(m_vpos.data(), m_vposCL, m_vpos.size() * sizeof(VertexPos), { e1 });
+		auto flg = _mm_movemask_ps(_mm_cmplt_ps(_mm_set_ps1(FLT_EPSILON), w));
+		auto posMargin = calcVertexState(p, bones[boneIdx[0]], setAll0(w));
+		if (flg & 0b0010) posMargin += calcVertexState(p, bones[boneIdx[1]], setAll1(w));
+		if (flg & 0b0100) posMargin += calcVertexState(p, bones[boneIdx[2]], setAll2(w));
+		if (flg & 0b1000) posMargin += calcVertexState(p, bones[boneIdx[3]], setAll3(w));
+		out[vertex].set(posMargin);
 	}
 
-#endif
-
-	SkinnedMeshBody::SkinnedMeshBody()
+	static void skinClusters(const Bone* bones, const VertexStream& stream, VertexPos* out)
 	{
-#ifdef ENABLE_CL
-		auto cl = hdtCL::instance();
-		if (cl)
+		for (auto& c : stream.m_clusters)
 		{
-			if (!m_kernel())
+			__m128 col[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+			__m128 margin = _mm_setzero_ps();
+			for (int j = 0; j < 4; ++j)
 			{
-				m_kernel.lock();
-				if (!m_kernel())
-					m_kernel = hdtCLKernel(cl->compile(sourceCode), "updateVertices");
-				m_kernel.unlock();
+				if (c.m_weight[j] <= 0) continue;
+
+				auto& bone = bones[c.m_boneIdx[j]];
+				auto w = _mm_set_ps1(c.m_weight[j]);
+				for (int k = 0; k < 4; ++k)
+					col[k] = _mm_add_ps(col[k], _mm_mul_ps(w, bone.m_vertexToWorld.m_col[k].get128()));
+				margin = _mm_add_ps(margin, _mm_mul_ps(w, _mm_set_ps1(bone.m_maginMultipler)));
+			}
+
+			// w of the result is the blended margin
+			for (int k = 0; k < 3; ++k)
+				col[k] = _mm_blend_ps(col[k], _mm_setzero_ps(), 0x8);
+			col[3] = _mm_blend_ps(col[3], margin, 0x8);
+
+			size_t size = c.m_vertices.size();
+			for (size_t i = 0; i < size; ++i)
+			{
+				auto p = c.m_skinPos[i].get128();
+				auto r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0], setAll0(p)), _mm_mul_ps(col[1], setAll1(p))), _mm_add_ps(_mm_mul_ps(col[2], setAll2(p)), col[3]));
+				out[c.m_vertices[i]].m_data = r;
 			}
 		}
-#endif
-		m_collisionShape = &m_bulletShape;
 	}
 
-	SkinnedMeshBody::~SkinnedMeshBody()
+	// Width vertices per iteration, bone matrices are gathered per lane. begin must be a multiple of VertexStream::Width
+	static void skinVerticesAVX2(const Bone* bones, const VertexStream& stream, VertexPos* out, int begin, int end)
 	{
-		//m_bonesGPU.discard_data();
-		//m_verticesGPU.discard_data();
+		static_assert(VertexStream::Width == 8, "kernel is written for 8 lanes");
+
+		auto base = reinterpret_cast<const float*>(bones);
+		auto stride = _mm256_set1_epi32(sizeof(Bone) / sizeof(float));
+		auto gather = [base](__m256i idx, int offset) { return _mm256_i32gather_ps(base + offset, idx, 4); };
+		auto load16 = [](const U16* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)); };
+		auto decode = [&](const U16* p, __m256 scale, __m256 offset) { return _mm256_fmadd_ps(_mm256_cvtepi32_ps(load16(p)), scale, offset); };
+
+		auto weightScale = _mm256_set1_ps(1.0f / 65535);
+		__m256 posScale[3], posMin[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			posScale[k] = _mm256_set1_ps(stream.m_posScale[k]);
+			posMin[k] = _mm256_set1_ps(stream.m_posMin[k]);
+		}
+
+		for (int i = begin; i < end; i += VertexStream::Width)
+		{
+			auto x = decode(&stream.m_skinPos[0][i], posScale[0], posMin[0]);
+			auto y = decode(&stream.m_skinPos[1][i], posScale[1], posMin[1]);
+			auto z = decode(&stream.m_skinPos[2][i], posScale[2], posMin[2]);
+			auto px = _mm256_setzero_ps();
+			auto py = _mm256_setzero_ps();
+			auto pz = _mm256_setzero_ps();
+			auto pm = _mm256_setzero_ps();
+
+			for (int j = 0; j < 4; ++j)
+			{
+				auto wi = load16(&stream.m_weight[j][i]);
+				if (j && _mm256_testz_si256(wi, wi)) continue;
+				auto w = _mm256_mul_ps(_mm256_cvtepi32_ps(wi), weightScale);
+
+				// offsets into Bone : columns of m_vertexToWorld at 0, 4, 8, 12, scaled margin at 19
+				auto idx = _mm256_mullo_epi32(load16(&stream.m_boneIdx[j][i]), stride);
+				auto tx = _mm256_fmadd_ps(gather(idx, 0), x, _mm256_fmadd_ps(gather(idx, 4), y, _mm256_fmadd_ps(gather(idx, 8), z, gather(idx, 12))));
+				auto ty = _mm256_fmadd_ps(gather(idx, 1), x, _mm256_fmadd_ps(gather(idx, 5), y, _mm256_fmadd_ps(gather(idx, 9), z, gather(idx, 13))));
+				auto tz = _mm256_fmadd_ps(gather(idx, 2), x, _mm256_fmadd_ps(gather(idx, 6), y, _mm256_fmadd_ps(gather(idx, 10), z, gather(idx, 14))));
+				px = _mm256_fmadd_ps(w, tx, px);
+				py = _mm256_fmadd_ps(w, ty, py);
+				pz = _mm256_fmadd_ps(w, tz, pz);
+				pm = _mm256_fmadd_ps(w, gather(idx, 19), pm);
+			}
+
+			// back to xyzm per vertex
+			auto xy0 = _mm256_unpacklo_ps(px, py);
+			auto xy1 = _mm256_unpackhi_ps(px, py);
+			auto zm0 = _mm256_unpacklo_ps(pz, pm);
+			auto zm1 = _mm256_unpackhi_ps(pz, pm);
+			__m256 v[4] = {
+				_mm256_shuffle_ps(xy0, zm0, 0x44),
+				_mm256_shuffle_ps(xy0, zm0, 0xEE),
+				_mm256_shuffle_ps(xy1, zm1, 0x44),
+				_mm256_shuffle_ps(xy1, zm1, 0xEE),
+			};
+
+			int count = std::min(end - i, VertexStream::Width);
+			for (int j = 0; j < count; ++j)
+			{
+				auto& lanes = v[j & 3];
+				out[stream.m_index[i + j]].m_data = j < 4 ? _mm256_castps256_ps128(lanes) : _mm256_extractf128_ps(lanes, 1);
+			}
+		}
 	}
 
-	__forceinline __m128 calcVertexState(__m128 skinPos, const Bone& bone, __m128 w)
+	static bool detectAVX2()
 	{
-		auto p = bone.m_vertexToWorld * skinPos;
-		p = _mm_blend_ps(p.get128(), _mm_load_ps(bone.m_reserved), 0x8);
-		return _mm_mul_ps(w, p.get128());
+		// FMA3 check also covers OS support of the ymm registers
+		if (!(btCpuFeatureUtility::getCpuFeatures() & btCpuFeatureUtility::CPU_FEATURE_FMA3))
+			return false;
+
+		int info[4];
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
 	}
 
-	void SkinnedMeshBody::internalUpdate()
+	bool SkinnedMeshBody::UseAVX2 = detectAVX2();
+	U32 SkinnedMeshBody::UpdateStamp = 0;
+
+	bool SkinnedMeshBody::updateBones()
 	{
+		bool dirty = false;
 		for (size_t i = 0; i < m_skinnedBones.size(); ++i)
 		{
 			auto& v = m_skinnedBones[i];
+			if (v.skinnedVersion == v.ptr->m_version) continue;
+
 			auto boneT = v.ptr->m_currentTransform;
 			m_bones[i].m_vertexToWorld = btMatrix4x3T(boneT) * v.vertexToBone;
 			m_bones[i].m_maginMultipler = v.ptr->m_marginMultipler * boneT.getScale();
+			v.skinnedVersion = v.ptr->m_version;
+			dirty = true;
 		}
+		return dirty;
+	}
 
-		int size = m_vpos.size();
+	bool SkinnedMeshBody::prepareUpdate()
+	{
+		// a vertex skipped by region skinning or by whole steps would sweep across several frames of motion
+		if (!m_vposPrev.empty())
+		{
+			auto shift = _mm_blend_ps(m_vposPrevShift.get128(), _mm_setzero_ps(), 0x8);	// w is the margin
+			for (size_t i = 0; i < m_vpos.size(); ++i)
+			{
+				if (m_vposStamp[i] != StalePrev && m_vposStamp[i] + 1 == UpdateStamp)
+					m_vposPrev[i].m_data = _mm_add_ps(m_vpos[i].m_data, shift);
+				else m_vposStamp[i] = StalePrev;
+			}
+		}
+		m_vposPrevShift.setZero();
 
-		for (int idx = 0; idx < size; ++idx)
+		// no bone moved since the last full update, vertices and collider tree are still valid
+		if (!updateBones() && m_shape->m_skinVersion == m_skinVersion)
 		{
-			auto& v = m_vertices[idx];
-			auto p = v.m_skinPos.get128();
-			auto w = _mm_load_ps(v.m_weight);
-			auto flg = _mm_movemask_ps(_mm_cmplt_ps(_mm_set_ps1(FLT_EPSILON), w));
-			auto posMargin = calcVertexState(p, m_bones[v.getBoneIdx(0)], setAll0(w));
-			if (flg & 0b0010) posMargin += calcVertexState(p, m_bones[v.getBoneIdx(1)], setAll1(w));
-			if (flg & 0b0100) posMargin += calcVertexState(p, m_bones[v.getBoneIdx(2)], setAll2(w));
-			if (flg & 0b1000) posMargin += calcVertexState(p, m_bones[v.getBoneIdx(3)], setAll3(w));
-			m_vpos[idx].set(posMargin);
+			updatePrevPositions(true);
+			m_bulletShape.m_aabb = m_shape->m_tree.aabbAll;
+			return false;
 		}
+		return true;
+	}
 
+	void SkinnedMeshBody::updatePrevPositions(bool all)
+	{
+		if (m_vposPrev.empty())
+			return;
+
+		for (size_t i = 0; i < m_vpos.size(); ++i)
+		{
+			bool skinned = all || m_regionMark[i] == m_skinVersion;
+			if (!skinned || m_vposStamp[i] == StalePrev)
+				m_vposPrev[i] = m_vpos[i];
+			if (skinned)
+				m_vposStamp[i] = UpdateStamp;
+		}
+	}
+
+	void SkinnedMeshBody::finishUpdate()
+	{
+		++m_skinVersion;
+		updatePrevPositions(true);
 		m_shape->internalUpdate();
+		m_shape->m_skinVersion = m_skinVersion;
+		m_bulletShape.m_aabb = m_shape->m_tree.aabbAll;
+	}
+
+	void SkinnedMeshBody::internalUpdate()
+	{
+		if (prepareUpdate())
+			skinAll();
+	}
+
+	void SkinnedMeshBody::skinAll()
+	{
+		skinClusters(m_bones.data(), m_vstream, m_vpos.data());
+		if (UseAVX2)
+			skinVerticesAVX2(m_bones.data(), m_vstream, m_vpos.data(), 0, m_vstream.m_count);
+		else for (auto i : m_vstream.m_index)
+			skinVertex(m_bones.data(), m_vstream, i, m_vpos.data());
+
+		finishUpdate();
+	}
+
+	void SkinnedMeshBody::internalUpdateRegion(const vectorA16<Aabb>& others)
+	{
+		// small bodies were skinned with their bounding spheres already
+		if (!m_useBoundingSphere)
+			return internalUpdate();
+
+		if (!prepareUpdate())
+			return;
+
+		auto vertexShape = m_shape->asPerTriangleShape() ? m_shape->asPerVertexShape() : nullptr;
+		bool all = m_shape->markRegion(others);
+		if (vertexShape)
+			all = vertexShape->markRegion(others) && all;
+		if (all)
+			return skinAll();
+
+		++m_skinVersion;
+		m_regionMark.resize(m_vpos.size(), ~0U);
+		std::function<void(ColliderTree&)> skin = [this](ColliderTree& node)
+		{
+			if (node.inRegion)
+			{
+				for (auto i : node.regionVertices)
+				{
+					if (m_regionMark[i] == m_skinVersion) continue;
+					m_regionMark[i] = m_skinVersion;
+					skinVertex(m_bones.data(), m_vstream, i, m_vpos.data());
+				}
+			}
+
+			for (auto& i : node.children)
+				skin(i);
+		};
+		skin(m_shape->m_tree);
+		if (vertexShape)
+			skin(vertexShape->m_tree);
+
+		// the rest of the vertices are stale, next full update has to redo everything
+		updatePrevPositions(false);
+		m_shape->internalUpdateRegion();
+		m_shape->m_skinVersion = ~0U;
+		if (vertexShape)
+		{
+			vertexShape->internalUpdateRegion();
+			vertexShape->m_skinVersion = m_skinVersion;
+		}
 		m_bulletShape.m_aabb = m_shape->m_tree.aabbAll;
 	}
 
@@ -206,14 +365,126 @@ __kernel void updateVertices(
 		m_shape->remapVertices(map.data());
 		m_vertices.resize(numUsed);
 		m_vpos.resize(numUsed);
+		m_vstream.build(m_vertices);
+		if (m_shape->m_continuous)
+		{
+			m_vposPrev.resize(m_vpos.size());
+			m_vposStamp.assign(m_vpos.size(), StalePrev);
+		}
+		m_shape->buildRegions();
+		if (m_shape->asPerTriangleShape())
+			m_shape->asPerVertexShape()->buildRegions();
+		growBoundingSpheres();
 
 		m_useBoundingSphere = m_shape->m_colliders.size() > 10;
 	}
 
+	struct TagRegistry
+	{
+		std::mutex lock;
+		std::unordered_map<IDStr, std::pair<int, int>> indices;	// bit and number of bodies holding it
+		std::vector<int> freeBits;
+		int next = 0;	// first bit never handed out
+	};
+
+	static TagRegistry& tagRegistry()
+	{
+		static TagRegistry registry;
+		return registry;
+	}
+
+	int TagMask::acquire(const IDStr& tag)
+	{
+		auto& r = tagRegistry();
+		std::lock_guard<std::mutex> l(r.lock);
+		auto iter = r.indices.find(tag);
+		if (iter != r.indices.end())
+		{
+			++iter->second.second;
+			return iter->second.first;
+		}
+
+		int ret;
+		if (!r.freeBits.empty())
+		{
+			ret = r.freeBits.back();
+			r.freeBits.pop_back();
+		}
+		else if (r.next < MaxTags)
+			ret = r.next++;
+		else
+			return -1;
+
+		r.indices.insert(std::make_pair(tag, std::make_pair(ret, 1)));
+		return ret;
+	}
+
+	void TagMask::release(const IDStr& tag)
+	{
+		auto& r = tagRegistry();
+		std::lock_guard<std::mutex> l(r.lock);
+		auto iter = r.indices.find(tag);
+		if (iter == r.indices.end() || --iter->second.second > 0)
+			return;
+
+		r.freeBits.push_back(iter->second.first);
+		r.indices.erase(iter);
+	}
+
+	static bool compileTags(TagMask& mask, const IDStr& tag, std::vector<IDStr>& refs)
+	{
+		int i = TagMask::acquire(tag);
+		if (i < 0) return false;
+		mask.set(i);
+		refs.push_back(tag);
+		return true;
+	}
+
+	void SkinnedMeshBody::compileFilter(int index, const void* group)
+	{
+		releaseFilter();
+		m_tagMaskValid = true;
+		for (auto& i : m_tags)
+			m_tagMaskValid &= compileTags(m_tagMask, i, m_tagRefs);
+		for (auto& i : m_canCollideWithTags)
+			m_tagMaskValid &= compileTags(m_canCollideWithTagMask, i, m_tagRefs);
+		for (auto& i : m_noCollideWithTags)
+			m_tagMaskValid &= compileTags(m_noCollideWithTagMask, i, m_tagRefs);
+
+		// bodies past the 64th of a system keep searching m_noCollideWithBones
+		m_filterGroup = group;
+		m_filterBit = index < 64 ? 1ULL << index : 0;
+		for (auto i : m_noCollideWithBones)
+		{
+			if (i->m_filterGroup != group)
+			{
+				i->m_filterGroup = group;
+				i->m_noCollideBodies = 0;
+			}
+			i->m_noCollideBodies |= m_filterBit;
+		}
+	}
+
+	void SkinnedMeshBody::releaseFilter()
+	{
+		for (auto& i : m_tagRefs)
+			TagMask::release(i);
+		m_tagRefs.clear();
+		m_tagMask = m_canCollideWithTagMask = m_noCollideWithTagMask = TagMask();
+		m_tagMaskValid = false;
+	}
+
 	bool SkinnedMeshBody::canCollideWith(const SkinnedMeshBody* body) const
 	{
 		if (m_isKinematic && body->m_isKinematic) return false;
 
+		if (m_tagMaskValid && body->m_tagMaskValid)
+		{
+			if (m_canCollideWithTags.empty())
+				return !m_noCollideWithTagMask.intersects(body->m_tagMask);
+			return m_canCollideWithTagMask.intersects(body->m_tagMask);
+		}
+
 		if (m_canCollideWithTags.empty())
 		{
 			for (auto& i : body->m_tags)
@@ -230,57 +501,155 @@ __kernel void updateVertices(
 		}
 	}
 
+	void SkinnedMeshBody::growBoundingSpheres()
+	{
+		for (auto& v : m_vertices)
+		{
+			for (int j = 0; j < 4; ++j)
+			{
+				if (v.m_weight[j] <= FLT_EPSILON) continue;
+
+				// bone space, like the sphere, so the margin is the unscaled one
+				auto& bone = m_skinnedBones[v.getBoneIdx(j)];
+				auto& sphere = bone.localBoundingSphere;
+				float radius = (bone.vertexToBone * v.m_skinPos - sphere.center()).length() + m_shape->getColliderMargin(bone.ptr->m_marginMultipler);
+				if (radius > sphere.radius())
+					sphere.m_centerRadius[3] = radius;
+			}
+		}
+	}
+
 	void SkinnedMeshBody::updateBoundingSphereAabb()
 	{
+		m_sphereSoA.resize(aligned<4>(static_cast<int>(m_skinnedBones.size())) * 4);
 		m_bulletShape.m_aabb.invalidate();
-		for (auto& i : m_skinnedBones)
+		for (int j = 0; j < m_skinnedBones.size(); ++j)
 		{
+			auto& i = m_skinnedBones[j];
 			auto sp = i.localBoundingSphere;
 			auto tr = i.ptr->m_currentTransform;
 			i.worldBoundingSphere = BoundingSphere(tr * sp.center(), tr.getScale() * sp.radius());
 			m_bulletShape.m_aabb.merge(i.worldBoundingSphere.getAabb());
+
+			auto block = &m_sphereSoA[(j & ~3) * 4 + (j & 3)];
+			auto center = i.worldBoundingSphere.center();
+			block[0] = center[0];
+			block[4] = center[1];
+			block[8] = center[2];
+			block[12] = i.worldBoundingSphere.radius();
 		}
 
 		if (!m_useBoundingSphere)
 			internalUpdate();
 	}
 
-	bool SkinnedMeshBody::isBoundingSphereCollided(SkinnedMeshBody * rhs)
+	void SkinnedMeshBody::shiftBounds(const btVector3& offset)
 	{
-		if (canCollideWith(rhs) && rhs->canCollideWith(this))
+		auto shift = _mm_blend_ps(offset.get128(), _mm_setzero_ps(), 0x8);
+		m_bulletShape.m_aabb.m_min = _mm_add_ps(m_bulletShape.m_aabb.m_min, shift);
+		m_bulletShape.m_aabb.m_max = _mm_add_ps(m_bulletShape.m_aabb.m_max, shift);
+		for (int j = 0; j < m_skinnedBones.size(); ++j)
+		{
+			auto& sphere = m_skinnedBones[j].worldBoundingSphere;
+			sphere.m_centerRadius.set128(_mm_add_ps(sphere.m_centerRadius.get128(), shift));
+			if (m_sphereSoA.empty()) continue;
+
+			auto block = &m_sphereSoA[(j & ~3) * 4 + (j & 3)];
+			block[0] += offset[0];
+			block[4] += offset[1];
+			block[8] += offset[2];
+		}
+	}
+
+	static inline U32 tailMask(size_t n)
+	{
+		return n >= 4 ? 0xF : (1U << n) - 1;
+	}
+
+	// spheres of a block touching the sphere c, r
+	static inline U32 sphereMask(const float* block, __m128 cx, __m128 cy, __m128 cz, __m128 r)
+	{
+		auto dx = _mm_sub_ps(_mm_loadu_ps(block), cx);
+		auto dy = _mm_sub_ps(_mm_loadu_ps(block + 4), cy);
+		auto dz = _mm_sub_ps(_mm_loadu_ps(block + 8), cz);
+		auto rr = _mm_add_ps(_mm_loadu_ps(block + 12), r);
+		auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_mul_ps(rr, rr)));
+	}
+
+	// spheres of a block touching the aabb
+	static inline U32 aabbMask(const float* block, const Aabb& aabb)
+	{
+		auto zero = _mm_setzero_ps();
+		auto cx = _mm_loadu_ps(block);
+		auto cy = _mm_loadu_ps(block + 4);
+		auto cz = _mm_loadu_ps(block + 8);
+		auto r = _mm_loadu_ps(block + 12);
+		auto dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(setAll0(aabb.m_min), cx), _mm_sub_ps(cx, setAll0(aabb.m_max))), zero);
+		auto dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(setAll1(aabb.m_min), cy), _mm_sub_ps(cy, setAll1(aabb.m_max))), zero);
+		auto dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(setAll2(aabb.m_min), cz), _mm_sub_ps(cz, setAll2(aabb.m_max))), zero);
+		auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_mul_ps(r, r)));
+	}
+
+	// spheres of body touching the aabb, paired with -1 on the other side
+	static void collideSpheresAabb(const SkinnedMeshBody* body, const Aabb& aabb, bool swap, SkinnedMeshBody::BonePairs& pairs)
+	{
+		auto size = body->m_skinnedBones.size();
+		for (size_t j = 0; j < size; j += 4)
+		{
+			unsigned long k;
+			U32 mask = aabbMask(&body->m_sphereSoA[j * 4], aabb) & tailMask(size - j);
+			while (_BitScanForward(&k, mask))
+			{
+				mask &= mask - 1;
+				int bone = static_cast<int>(j + k);
+				pairs.push_back(swap ? std::make_pair(-1, bone) : std::make_pair(bone, -1));
+			}
+		}
+	}
+
+	bool SkinnedMeshBody::isBoundingSphereCollided(SkinnedMeshBody * rhs, BonePairs& pairs)
+	{
+		pairs.clear();
+		if (!canCollideWith(rhs) || !rhs->canCollideWith(this))
+			return false;
+
+		if (m_useBoundingSphere && rhs->m_useBoundingSphere)
+		{
+			auto size = rhs->m_skinnedBones.size();
+			for (int i = 0; i < m_skinnedBones.size(); ++i)
+			{
+				auto& sphere = m_skinnedBones[i].worldBoundingSphere;
+				auto cx = setAll0(sphere.m_centerRadius.get128());
+				auto cy = setAll1(sphere.m_centerRadius.get128());
+				auto cz = setAll2(sphere.m_centerRadius.get128());
+				auto r = setAll3(sphere.m_centerRadius.get128());
+				for (size_t j = 0; j < size; j += 4)
+				{
+					unsigned long k;
+					U32 mask = sphereMask(&rhs->m_sphereSoA[j * 4], cx, cy, cz, r) & tailMask(size - j);
+					while (_BitScanForward(&k, mask))
+					{
+						mask &= mask - 1;
+						int bone = static_cast<int>(j + k);
+						if (m_skinnedBones[i].isKinematic && rhs->m_skinnedBones[bone].isKinematic)
+							continue;
+						pairs.push_back(std::make_pair(i, bone));
+					}
+				}
+			}
+			return !pairs.empty();
+		}
+		else if (m_useBoundingSphere)
+			collideSpheresAabb(this, rhs->m_bulletShape.m_aabb, false, pairs);
+		else if (rhs->m_useBoundingSphere)
+			collideSpheresAabb(rhs, m_bulletShape.m_aabb, true, pairs);
+		else
 		{
+			pairs.push_back(std::make_pair(-1, -1));
 			return true;
-			//if (m_useBoundingSphere && rhs->m_useBoundingSphere)
-			//{
-			//	for (auto& i : m_skinnedBones)
-			//	{
-			//		for (auto& j : rhs->m_skinnedBones)
-			//		{
-			//			if (i.isKinematic && j.isKinematic)
-			//				continue;
-			//			if (i.worldBoundingSphere.isCollide(j.worldBoundingSphere))
-			//				return true;
-			//		}
-			//	}
-			//}
-			//else if (m_useBoundingSphere)
-			//{
-			//	for (auto& i : m_skinnedBones)
-			//	{
-			//		if (rhs->m_bulletShape.m_aabb.collideWithSphere(i.worldBoundingSphere.center(), i.worldBoundingSphere.radius()))
-			//			return true;
-			//	}
-			//}
-			//else if (rhs->m_useBoundingSphere)
-			//{
-			//	for (auto& i : rhs->m_skinnedBones)
-			//	{
-			//		if (m_bulletShape.m_aabb.collideWithSphere(i.worldBoundingSphere.center(), i.worldBoundingSphere.radius()))
-			//			return true;
-			//	}
-			//}
-			//else return true;
 		}
-		return false;
+		return !pairs.empty();
 	}
 }
\ No newline at end of file
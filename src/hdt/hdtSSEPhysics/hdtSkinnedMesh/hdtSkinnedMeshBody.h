@@ -13,6 +13,22 @@ namespace hdt
 {
 	class SkinnedMeshShape;
 
+	// tags get dense bits while compiled bodies use them, tag filtering is then a couple of ANDs. bits are ref counted by
+	// the bodies holding them and handed out again once the last one leaves the world.
+	// bodies using tags past MaxTags keep filtering through the sets
+	struct TagMask
+	{
+		static const int MaxTags = 128;
+
+		U64 bits[MaxTags / 64] = {};
+
+		inline void set(int i) { bits[i >> 6] |= 1ULL << (i & 63); }
+		inline bool intersects(const TagMask& rhs) const { return ((bits[0] & rhs.bits[0]) | (bits[1] & rhs.bits[1])) != 0; }
+
+		static int acquire(const IDStr& tag);	// -1 while every bit is taken
+		static void release(const IDStr& tag);
+	};
+
 	class SkinnedMeshBody
 		: public btCollisionObject
 		, public RefObject
@@ -22,6 +38,11 @@ namespace hdt
 		SkinnedMeshBody();
 		virtual ~SkinnedMeshBody();
 
+		// tagged in m_internalType so collision objects are told apart without rtti
+		static const int InternalType = CO_USER_TYPE;
+		static inline SkinnedMeshBody* upcast(btCollisionObject* o) { return o->getInternalType() == InternalType ? static_cast<SkinnedMeshBody*>(o) : nullptr; }
+		static inline const SkinnedMeshBody* upcast(const btCollisionObject* o) { return o->getInternalType() == InternalType ? static_cast<const SkinnedMeshBody*>(o) : nullptr; }
+
 		struct CollisionShape : public btCollisionShape // a shape only used for markout
 		{
 			CollisionShape() : m_aabb(_mm_setzero_ps(), _mm_setzero_ps()){ m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE; }
@@ -45,6 +66,7 @@ namespace hdt
 			SkinnedMeshBone* ptr = nullptr;
 			float			weightThreshold;
 			bool			isKinematic;
+			U32				skinnedVersion = ~0U;	// bone version m_bones was last built from
 		};
 
 		IDStr m_name;
@@ -57,24 +79,79 @@ namespace hdt
 		int addBone(SkinnedMeshBone* bone, const btQsTransform& verticesToBone, const BoundingSphere& boundingSphere);
 
 		void finishBuild();
+		// bone bounding spheres come from the nif and may miss vertices, they are grown to hold every vertex weighted to the
+		// bone, with its collider margin, since culling and region skinning rely on them
+		void growBoundingSpheres();
+		bool updateBones();	// returns true if any bone moved since the last update
+		bool prepareUpdate();	// updates the bones, returns false if the vertices don't need skinning again
+		void finishUpdate();	// colliders and aabb from freshly skinned vertices
+		void skinAll();
 		virtual void internalUpdate();
+		// skins only the colliders that can reach one of the aabbs, the others are left out until the next full update
+		void internalUpdateRegion(const vectorA16<Aabb>& others);
 		
 		std::vector<SkinnedBone>	m_skinnedBones;
 		std::vector<Bone>			m_bones;
 
 		std::vector<Vertex> m_vertices;
 		std::vector<VertexPos> m_vpos;
+		std::vector<VertexPos> m_vposPrev;	// m_vpos of the last update, only kept for continuous shapes
+		std::vector<U32> m_vposStamp;	// UpdateStamp each vertex of m_vpos was skinned in, only a vertex skinned the step before has something to sweep from
+		btVector3 m_vposPrevShift = btVector3(0, 0, 0);	// local frame moves since m_vpos was skinned, added to m_vposPrev by the next update
+
+		static U32 UpdateStamp;	// bumped by the world every step
+		static constexpr U32 StalePrev = ~0U;
+
+		inline void shiftPrevPositions(const btVector3& offset) { m_vposPrevShift += offset; }
+		// nothing to sweep from (teleported or reset), every vertex starts over from its next skinned position
+		inline void rebasePrevPositions() { std::fill(m_vposStamp.begin(), m_vposStamp.end(), StalePrev); }
+		// after skinning, vertices without a position of the last step and the ones left unskinned get m_vposPrev = m_vpos
+		void updatePrevPositions(bool all);
+		VertexStream m_vstream;
+		U32 m_skinVersion = 0;	// bumped every time m_vpos is skinned again
+		U32 m_dispatchEpoch = 0;	// dispatch that last put this body in its batch, at m_batchIndex
+		U32 m_batchIndex = 0;
+		std::vector<U32> m_regionMark;	// skin version each vertex was last region skinned in
+
+		static bool UseAVX2;	// skin the m_vstream lanes with the 8 wide kernel, set from cpuid
 
 		std::vector<IDStr> m_tags;
 		std::unordered_set<IDStr> m_canCollideWithTags;
 		std::unordered_set<IDStr> m_noCollideWithTags;
 		std::vector<SkinnedMeshBone*> m_noCollideWithBones;
+
+		// filters above compiled by the world when the system is added
+		bool	m_tagMaskValid = false;
+		TagMask	m_tagMask;
+		TagMask	m_canCollideWithTagMask;
+		TagMask	m_noCollideWithTagMask;
+		const void* m_filterGroup = nullptr;	// owner of the bones that may be in m_noCollideWithBones
+		U64		m_filterBit = 0;				// bit of this body in SkinnedMeshBone::m_noCollideBodies, 0 if it has none
+
+		// index is the body's place in its system, group the system itself
+		void compileFilter(int index, const void* group);
+		void releaseFilter();	// gives the tag bits back, when the body leaves the world
+		std::vector<IDStr> m_tagRefs;	// tags this body holds a bit of
 		
 		float flexible(const Vertex& v);
-		bool canCollideWith(const SkinnedMeshBone* bone) const { return std::find(m_noCollideWithBones.begin(), m_noCollideWithBones.end(), bone) == m_noCollideWithBones.end(); }
+		inline bool canCollideWith(const SkinnedMeshBone* bone) const
+		{
+			if (m_filterBit)
+				return bone->m_filterGroup != m_filterGroup || !(bone->m_noCollideBodies & m_filterBit);
+			return std::find(m_noCollideWithBones.begin(), m_noCollideWithBones.end(), bone) == m_noCollideWithBones.end();
+		}
 		virtual bool canCollideWith(const SkinnedMeshBody* body) const;
 
+		// world bounding spheres of m_skinnedBones in blocks of 4 : x[4], y[4], z[4], radius[4]
+		vectorA16<float> m_sphereSoA;
+
+		// bone pairs whose bounding spheres touch, -1 stands for the whole body on a side without bounding spheres
+		typedef std::vector<std::pair<int, int>> BonePairs;
+
 		void	updateBoundingSphereAabb();
-		bool	isBoundingSphereCollided(SkinnedMeshBody* rhs);
+		// bounds of a body that isn't updated (its system is asleep or inactive) follow a local frame move by hand
+		void	shiftBounds(const btVector3& offset);
+		bool	isBoundingSphereCollided(SkinnedMeshBody* rhs, BonePairs& pairs);
+		Aabb	getBoneRegion(int bone) const { return bone < 0 ? m_bulletShape.m_aabb : m_skinnedBones[bone].worldBoundingSphere.getAabb(); }
 	};
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 namespace hdt
 {
+	float SkinnedMeshBone::VersionRotationTolerance = 1e-5f;
+	float SkinnedMeshBone::VersionOriginTolerance = 1e-3f;
+
 	SkinnedMeshBone::SkinnedMeshBone(const IDStr& name, btRigidBody::btRigidBodyConstructionInfo& ci)
 		: m_name(name), m_rig(ci)
 	{
@@ -23,6 +26,12 @@ namespace hdt
 		auto t = m_rigToLocal * m_rig.getInterpolationWorldTransform();
 		m_currentTransform.setBasis(t.getBasis());
 		m_currentTransform.setOrigin(t.getOrigin());
+
+		if (m_version && m_currentTransform.fuzzyEquals(m_skinnedTransform, VersionRotationTolerance, VersionOriginTolerance))
+			return;
+
+		m_skinnedTransform = m_currentTransform;
+		++m_version;
 	}
 
 	bool SkinnedMeshBone::canCollideWith(SkinnedMeshBone* rhs)
@@ -33,7 +42,7 @@ namespace hdt
 		}
 		else
 		{
-			return std::find(m_noCollideWithBone.begin(), m_noCollideWithBone.end(), rhs->m_name) != m_noCollideWithBone.end();
+			return std::find(m_noCollideWithBone.begin(), m_noCollideWithBone.end(), rhs->m_name) == m_noCollideWithBone.end();
 		}
 	}
 }
\ No newline at end of file
@@ -24,9 +24,21 @@ namespace hdt
 		btTransform m_rigToLocal;
 		btQsTransform m_currentTransform;
 
+		// bumped by internalUpdate when the pose bodies are skinned with moved by more than the tolerances.
+		// read and write back store the skeleton's world transform in m_currentTransform, only internalUpdate
+		// sees it in the frame the bodies are simulated in, so only that one is compared
+		U32 m_version = 0;
+		btQsTransform m_skinnedTransform;
+		static float VersionRotationTolerance;
+		static float VersionOriginTolerance;
+
 		std::vector<IDStr>	m_canCollideWithBone;
 		std::vector<IDStr>	m_noCollideWithBone;
 
+		// bodies of the same system that don't collide with this bone, see SkinnedMeshBody::compileFilter
+		const void*	m_filterGroup = nullptr;
+		U64			m_noCollideBodies = 0;
+
 		virtual void readTransform(float timeStep) = 0;
 		virtual void writeTransform() = 0;
 
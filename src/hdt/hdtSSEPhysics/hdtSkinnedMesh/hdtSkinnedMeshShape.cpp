@@ -32,142 +32,100 @@ namespace hdt
 		});
 	}
 
-#ifdef ENABLE_CL
-	static const std::string sourceVtxUpdate = R"__KERNEL(
-typedef struct Aabb
-{
-	float4 aabbMin;
-	float4 aabbMax;
-} Aabb;
+	void SkinnedMeshShape::buildRegions()
+	{
+		int vertexPerCollider = getBonePerCollider() / 4;
+		std::function<void(ColliderTree&)> build = [&, this](ColliderTree& node)
+		{
+			node.regionBones.clear();
+			node.regionVertices.clear();
+			for (U32 i = 0; i < node.numCollider; ++i)
+			{
+				auto c = &node.cbuf[i];
+				for (int j = 0; j < vertexPerCollider; ++j)
+					node.regionVertices.push_back(c->vertices[j]);
+				for (int j = 0; j < getBonePerCollider(); ++j)
+					if (getColliderBoneWeight(c, j) > FLT_EPSILON)
+						node.regionBones.push_back(getColliderBoneIndex(c, j));
+			}
 
-__kernel void updateCollider(__global float4* vertices, __global uint4* colliders, __global Aabb* aabbs, float margin)
-{
-	int idx = get_global_id(0);
-	float4 data = vertices[colliders[idx].x];
-	float3 p0 = data.xyz;
-	float m = margin * data.w;
-	
-	Aabb aabb;
-	aabb.aabbMin.xyz = p0 - m;
-	aabb.aabbMax.xyz = p0 + m;
-	
-	aabbs[idx] = aabb;
-}
-)__KERNEL";
+			std::sort(node.regionBones.begin(), node.regionBones.end());
+			node.regionBones.erase(std::unique(node.regionBones.begin(), node.regionBones.end()), node.regionBones.end());
+			std::sort(node.regionVertices.begin(), node.regionVertices.end());
+			node.regionVertices.erase(std::unique(node.regionVertices.begin(), node.regionVertices.end()), node.regionVertices.end());
 
-	hdtCLKernel PerVertexShape::m_kernel;
+			for (auto& i : node.children)
+				build(i);
+		};
+		build(m_tree);
+	}
 
-	void PerVertexShape::internalUpdateCL()
+	float SkinnedMeshShape::getRegionMargin()
 	{
-		auto cl = hdtCL::instance();
-
-		if (!m_colliderCL())
-		{
-			m_colliderCL = cl->createBuffer(sizeof(Collider)* m_colliders.size(), CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, 0);
-			m_aabbCL = cl->createBuffer(sizeof(Aabb)* m_aabb.size(), CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, 0);
-			cl->writeBuffer(m_colliderCL, m_colliders.data(), sizeof(Collider)* m_colliders.size(), true);
-		}
-
-		m_kernel.lock();
-		m_kernel.setArg(0, m_owner->m_vposCL);
-		m_kernel.setArg(1, m_colliderCL);
-		m_kernel.setArg(2, m_aabbCL);
-		m_kernel.setArg(3, m_shapeProp.margin);
-		auto e0 = m_kernel.runE({ m_colliders.size() });
-		m_kernel.unlock();
-		m_eDoneCL = cl->readBufferE(m_aabb.data(), m_aabbCL, m_aabb.size() * sizeof(Aabb), { e0 });
+		float multiplier = 0;
+		for (auto& i : m_owner->m_bones)
+			multiplier = std::max(multiplier, i.m_maginMultipler);
+		return getColliderMargin(multiplier);
 	}
 
-	static const std::string sourceTriUpdate = R"__KERNEL(
-typedef struct Aabb
-{
-	float3 aabbMin;
-	float3 aabbMax;
-} Aabb;
+	bool SkinnedMeshShape::markRegion(const vectorA16<Aabb>& aabbs)
+	{
+		// a skinned vertex is a weighted average of its bones' transforms, so it stays inside the aabb of their bounding spheres
+		// (SkinnedMeshBody::growBoundingSpheres makes sure every bone's sphere holds the vertex as that bone alone moves it)
+		float margin = getRegionMargin();
+		bool all = true;
+		std::function<void(ColliderTree&)> mark = [&, this](ColliderTree& node)
+		{
+			if (node.numCollider)
+			{
+				Aabb aabb;
+				for (auto i : node.regionBones)
+					aabb.merge(m_owner->m_skinnedBones[i].worldBoundingSphere.getAabb());
+				aabb.extendMargin(margin);
 
-void aabbMerge(Aabb* aabb, float3 pt)
-{
-	aabb->aabbMin = fmin(aabb->aabbMin, pt);
-	aabb->aabbMax = fmax(aabb->aabbMax, pt);
-}
+				node.inRegion = std::any_of(aabbs.begin(), aabbs.end(), [&](const Aabb& i) { return aabb.collideWith(i); });
+				all &= !!node.inRegion;
+			}
 
-void aabbExpand(Aabb* aabb, float margin)
-{
-	aabb->aabbMin -= margin;
-	aabb->aabbMax += margin;
-}
+			for (auto& i : node.children)
+				mark(i);
+		};
+		mark(m_tree);
+		return all;
+	}
 
-__kernel void updateCollider(__global float4* vertices, __global uint4* colliders, __global Aabb* aabbs, float penetration, float margin)
-{
-	int idx = get_global_id(0);
-	float3 p0 = vertices[colliders[idx].x].s012;
-	float3 p1 = vertices[colliders[idx].y].s012;
-	float3 p2 = vertices[colliders[idx].z].s012;
-	float m = vertices[colliders[idx].x].w + vertices[colliders[idx].y].w + vertices[colliders[idx].z].w;
-	
-	Aabb aabb;
-	aabb.aabbMin = aabb.aabbMax = p0;
-	aabbMerge(&aabb, p1);
-	aabbMerge(&aabb, p2);
-	aabbExpand(&aabb, margin * m / 3.0f);
-	
-	if(penetration > FLT_EPSILON || penetration < -FLT_EPSILON)
+	void SkinnedMeshShape::internalUpdateRegion()
 	{
-		float3 normal = cross((p1-p0).s012, (p2-p0).s012);
-		float len2 = dot(normal, normal);
-		if(len2 > FLT_EPSILON * FLT_EPSILON)
+		std::function<void(ColliderTree&)> update = [&, this](ColliderTree& node)
 		{
-			normal = normalize(normal) * penetration;
-			aabb.aabbMin = fmin(aabb.aabbMin, aabb.aabbMin - normal);
-			aabb.aabbMax = fmax(aabb.aabbMax, aabb.aabbMax - normal);
-		}
+			if (node.numCollider && node.inRegion)
+			{
+				size_t begin = node.cbuf - m_colliders.data();
+				updateColliderAabbs(begin, begin + node.numCollider);
+			}
+
+			for (auto& i : node.children)
+				update(i);
+		};
+		update(m_tree);
+		refitTree(true);
 	}
-	aabbs[idx] = aabb;
-}
-)__KERNEL";
 
-	hdtCLKernel PerTriangleShape::m_kernel;
+	static std::atomic<U32> s_fatVersion(0);
 
-	void PerTriangleShape::internalUpdateCL()
+	void SkinnedMeshShape::refitTree(bool region)
 	{
-		auto cl = hdtCL::instance();
-
-		if (!m_colliderCL())
-		{
-			m_colliderCL = cl->createBuffer(sizeof(Collider)* m_colliders.size(), CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, 0);
-			m_aabbCL = cl->createBuffer(sizeof(Aabb)* m_aabb.size(), CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, 0);
-			cl->writeBuffer(m_colliderCL, m_colliders.data(), sizeof(Collider)* m_colliders.size(), true);
-		}
+		if (region)
+			m_tree.updateAabbRegion();
+		else m_tree.updateAabb();
 
-		m_kernel.lock();
-		m_kernel.setArg(0, m_owner->m_vposCL);
-		m_kernel.setArg(1, m_colliderCL);
-		m_kernel.setArg(2, m_aabbCL);
-		m_kernel.setArg(3, m_shapeProp.penetration);
-		m_kernel.setArg(4, m_shapeProp.margin);
-		auto e0 = m_kernel.runE({ m_colliders.size() });
-		m_kernel.unlock();
-		m_eDoneCL = cl->readBufferE(m_aabb.data(), m_aabbCL, m_aabb.size() * sizeof(Aabb), { e0 });
+		if (m_tree.updateFatAabb())
+			m_fatVersion = ++s_fatVersion;
 	}
 
-#endif
-
 	PerVertexShape::PerVertexShape(SkinnedMeshBody* body)
 		: SkinnedMeshShape(body)
 	{
-#ifdef ENABLE_CL
-		auto cl = hdtCL::instance();
-		if (cl)
-		{
-			if (!m_kernel())
-			{
-				m_kernel.lock();
-				if (!m_kernel())
-					m_kernel = hdtCLKernel(cl->compile(sourceVtxUpdate), "updateCollider");
-				m_kernel.unlock();
-			}
-		}
-#endif
 	}
 
 	PerVertexShape::~PerVertexShape()
@@ -178,6 +136,15 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 	{
 		bool hasDynamic = false;
 
+		if (m_useBvh)
+		{
+			m_tree.buildBvh([this](const Collider* c)
+			{
+				Aabb aabb;
+				aabb.merge(m_owner->m_vertices[c->vertex].m_skinPos);
+				return aabb;
+			});
+		}
 		m_tree.optimize();
 		m_tree.updateKinematic([this](const Collider* n)
 		{
@@ -188,24 +155,36 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 
 		m_tree.exportColliders(m_colliders);
 		m_aabb.resize(m_colliders.size());
+		m_aabbSoA.resize(m_colliders.size());
 		m_tree.remapColliders(m_colliders.data(), m_aabb.data());
 	}
 
 	void PerVertexShape::internalUpdate()
+	{
+		updateColliderAabbs(0, m_colliders.size());
+		refitTree();
+	}
+
+	void PerVertexShape::updateColliderAabbs(size_t begin, size_t end)
 	{
 		auto& vertices = m_owner->m_vpos;
 
-		size_t size = m_colliders.size();
-		for (size_t i = 0; i < size; ++i)
+		for (size_t i = begin; i < end; ++i)
 		{
 			auto c = &m_colliders[i];
 			auto p0 = vertices[c->vertex].m_data;
 			auto margin = _mm_set_ps1(p0.m128_f32[3] * m_shapeProp.margin);
 			m_aabb[i].m_min = p0 - margin;
 			m_aabb[i].m_max = p0 + margin;
+			if (m_continuous)
+				m_aabb[i].merge(Aabb(m_owner->m_vposPrev[c->vertex].m_data, m_owner->m_vposPrev[c->vertex].m_data).extended(p0.m128_f32[3] * m_shapeProp.margin));
+			m_aabbSoA.set(i, m_aabb[i]);
 		}
+	}
 
-		m_tree.updateAabb();
+	float PerVertexShape::getColliderMargin(float marginMultiplier)
+	{
+		return marginMultiplier * m_shapeProp.margin;
 	}
 
 	void PerVertexShape::autoGen()
@@ -238,19 +217,6 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 	PerTriangleShape::PerTriangleShape(SkinnedMeshBody* body)
 		: SkinnedMeshShape(body)
 	{
-#ifdef ENABLE_CL
-		auto cl = hdtCL::instance();
-		if (cl)
-		{
-			if (!m_kernel())
-			{
-				m_kernel.lock();
-				if (!m_kernel())
-					m_kernel = hdtCLKernel(cl->compile(sourceTriUpdate), "updateCollider");
-				m_kernel.unlock();
-			}
-		}
-#endif
 	}
 
 	PerTriangleShape::~PerTriangleShape()
@@ -258,11 +224,16 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 	}
 	
 	void PerTriangleShape::internalUpdate()
+	{
+		updateColliderAabbs(0, m_colliders.size());
+		refitTree();
+	}
+
+	void PerTriangleShape::updateColliderAabbs(size_t begin, size_t end)
 	{
 		auto& vertices = m_owner->m_vpos;
 
-		size_t size = m_colliders.size();
-		for (size_t i = 0; i < size; ++i)
+		for (size_t i = begin; i < end; ++i)
 		{
 			auto c = &m_colliders[i];
 			auto p0 = vertices[c->vertices[0]].m_data;
@@ -281,13 +252,27 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 
 			m_aabb[i].m_min = aabbMin;
 			m_aabb[i].m_max = aabbMax;
+			m_aabbSoA.set(i, m_aabb[i]);
 		}
+	}
 
-		m_tree.updateAabb();
+	float PerTriangleShape::getColliderMargin(float marginMultiplier)
+	{
+		return std::max(marginMultiplier * m_shapeProp.margin, std::abs(m_shapeProp.penetration));
 	}
 
 	void PerTriangleShape::finishBuild()
 	{
+		if (m_useBvh)
+		{
+			m_tree.buildBvh([this](const Collider* c)
+			{
+				Aabb aabb;
+				for (int i = 0; i < 3; ++i)
+					aabb.merge(m_owner->m_vertices[c->vertices[i]].m_skinPos);
+				return aabb;
+			});
+		}
 		m_tree.optimize();
 		m_tree.updateKinematic([=](const Collider* c)
 		{
@@ -301,11 +286,14 @@ __kernel void updateCollider(__global float4* vertices, __global uint4* collider
 
 		m_tree.exportColliders(m_colliders);
 		m_aabb.resize(m_colliders.size());
+		m_aabbSoA.resize(m_colliders.size());
 		m_tree.remapColliders(m_colliders.data(), m_aabb.data());
 
 		Ref<PerTriangleShape> holder = this;
 		m_verticesCollision = new PerVertexShape(m_owner);
 		m_verticesCollision->m_shapeProp.margin = m_shapeProp.margin;
+		m_verticesCollision->m_useBvh = m_useBvh;
+		m_verticesCollision->m_continuous = m_continuous;
 		m_owner->m_shape = this;
 		
 		m_verticesCollision->autoGen();
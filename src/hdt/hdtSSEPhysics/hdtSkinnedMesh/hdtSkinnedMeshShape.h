@@ -25,6 +25,15 @@ namespace hdt
 		virtual void clipColliders();
 		virtual void finishBuild() = 0;
 		virtual void internalUpdate() = 0;
+		virtual void updateColliderAabbs(size_t begin, size_t end) = 0;
+		float getRegionMargin();	// upper bound of the margin any collider is extended with
+		virtual float getColliderMargin(float marginMultiplier) = 0;	// margin of colliders on bones with that multiplier
+
+		// region skinning, only the tree nodes whose bones' bounding spheres can reach one of the aabbs are kept
+		void buildRegions();
+		bool markRegion(const vectorA16<Aabb>& aabbs);	// returns true if every node is in the region
+		void internalUpdateRegion();
+		void refitTree(bool region = false);	// tree aabbs from the collider aabbs, bumps m_fatVersion if a fat bound moved
 		virtual int getBonePerCollider() = 0;
 		virtual void markUsedVertices(bool* flags) = 0;
 		virtual void remapVertices(UINT* map) = 0;
@@ -40,16 +49,14 @@ namespace hdt
 
 		SkinnedMeshBody*	m_owner;
 		vectorA16<Aabb>		m_aabb;
+		AabbSoA				m_aabbSoA;	// copy of m_aabb for the narrowphase
 		vectorA16<Collider> m_colliders;
 		ColliderTree		m_tree;
 		float				m_windEffect = 0.f;
-
-#ifdef ENABLE_CL
-		cl::Buffer		m_aabbCL;
-		cl::Buffer		m_colliderCL;
-		cl::Event		m_eDoneCL;
-		virtual void internalUpdateCL() = 0;
-#endif
+		U32					m_skinVersion = ~0U;	// skin version of the owner the colliders were last updated from
+		bool				m_useBvh = false;		// SAH tree over the rest pose instead of grouping colliders by bones
+		U32					m_fatVersion = 0;		// unique over all shapes, changes whenever the fat bounds of the tree do
+		bool				m_continuous = false;	// spheres moving further than their radius in a step are swept against triangles
 	};
 
 	class PerVertexShape : public SkinnedMeshShape
@@ -61,6 +68,8 @@ namespace hdt
 		virtual PerVertexShape* asPerVertexShape(){ return this; }
 
 		virtual void internalUpdate() override;
+		virtual void updateColliderAabbs(size_t begin, size_t end) override;
+		virtual float getColliderMargin(float marginMultiplier) override;
 		virtual int getBonePerCollider() override { return 4; }
 		virtual float getColliderBoneWeight(const Collider* c, int boneIdx) override { return m_owner->m_vertices[c->vertex].m_weight[boneIdx]; }
 		virtual int getColliderBoneIndex(const Collider* c, int boneIdx) override { return m_owner->m_vertices[c->vertex].getBoneIdx(boneIdx); }
@@ -76,11 +85,6 @@ namespace hdt
 		{
 			float margin = 1.0f;
 		} m_shapeProp;
-
-#ifdef ENABLE_CL
-		static hdtCLKernel		m_kernel;
-		virtual void internalUpdateCL();
-#endif
 	};
 
 
@@ -94,6 +98,8 @@ namespace hdt
 		virtual PerTriangleShape* asPerTriangleShape(){ return this; }
 
 		virtual void internalUpdate() override;
+		virtual void updateColliderAabbs(size_t begin, size_t end) override;
+		virtual float getColliderMargin(float marginMultiplier) override;
 		virtual int getBonePerCollider() override  { return 12; }
 		virtual float getColliderBoneWeight(const Collider* c, int boneIdx) override {
 			return m_owner->m_vertices[c->vertices[boneIdx/4]].m_weight[boneIdx%4];
@@ -118,10 +124,6 @@ namespace hdt
 		} m_shapeProp;
 		
 		Ref<PerVertexShape> m_verticesCollision;
-
-#ifdef ENABLE_CL
-		static hdtCLKernel		m_kernel;
-		virtual void internalUpdateCL();
-#endif
+		U32 m_dispatchEpoch = 0;	// dispatch that last queued m_verticesCollision for an update
 	};
 }
\ No newline at end of file
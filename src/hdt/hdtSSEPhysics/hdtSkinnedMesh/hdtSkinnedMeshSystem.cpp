@@ -3,12 +3,17 @@
 #include "hdtSkinnedMeshBody.h"
 #include "hdtSkinnedMeshShape.h"
 #include "hdtBoneScaleConstraint.h"
+#include "hdtSkinnedMeshWorld.h"
 
 namespace hdt
 {
-	void SkinnedMeshSystem::readTransform(float timeStep)
+	int SkinnedMeshSystem::ParallelBoneCount = 64;
+
+	void SkinnedMeshSystem::readBoneTransform(float timeStep)
 	{
-		for (int i = 0; i < m_bones.size(); ++i)
+		if (m_bones.size() >= ParallelBoneCount)
+			concurrency::parallel_for(0, (int)m_bones.size(), [&](int i) { m_bones[i]->readTransform(timeStep); });
+		else for (int i = 0; i < m_bones.size(); ++i)
 			m_bones[i]->readTransform(timeStep);
 
 		for (auto i : m_constraints)
@@ -16,16 +21,100 @@ namespace hdt
 
 		for (auto i : m_constraintGroups)
 			i->scaleConstraint();
+
+		if (m_sleeping && m_world)
+		{
+			auto& setting = m_world->getSleepSetting();
+			if (timeStep <= 0 || isKinematicMoving(setting.m_kinematicLinearThreshold, setting.m_kinematicAngularThreshold))
+				wakeUp();
+		}
 	}
 
 	void SkinnedMeshSystem::writeTransform()
 	{
-		for (int i = 0; i < m_bones.size(); ++i)
+		auto write = [this](int i)
 		{
-			if (m_bones[i]->m_rig.isKinematicObject()) continue;
+			if (m_bones[i]->m_rig.isKinematicObject()) return;
 
 			m_bones[i]->writeTransform();
+		};
+
+		if (m_bones.size() >= ParallelBoneCount)
+			concurrency::parallel_for(0, (int)m_bones.size(), write);
+		else for (int i = 0; i < m_bones.size(); ++i)
+			write(i);
+	}
+
+	void SkinnedMeshSystem::setActive(bool active)
+	{
+		if (m_active == active) return;
+		m_active = active;
+		applyActivationState();
+	}
+
+	void SkinnedMeshSystem::sleep()
+	{
+		m_sleeping = true;
+		for (auto& i : m_bones)
+		{
+			if (i->m_rig.isStaticOrKinematicObject()) continue;
+			i->m_rig.setLinearVelocity(btVector3(0, 0, 0));
+			i->m_rig.setAngularVelocity(btVector3(0, 0, 0));
+		}
+		applyActivationState();
+	}
+
+	void SkinnedMeshSystem::wakeUp()
+	{
+		m_sleeping = false;
+		m_sleepTime = 0;
+		applyActivationState();
+	}
+
+	void SkinnedMeshSystem::applyActivationState()
+	{
+		int state = !m_active ? DISABLE_SIMULATION : m_sleeping ? ISLAND_SLEEPING : ACTIVE_TAG;
+		for (auto& i : m_bones)
+			i->m_rig.forceActivationState(state == ACTIVE_TAG ? DISABLE_DEACTIVATION : state);
+		for (auto& i : m_meshes)
+			i->forceActivationState(state);
+	}
+
+	bool SkinnedMeshSystem::isKinematicMoving(float linearThreshold, float angularThreshold) const
+	{
+		auto linear2 = linearThreshold * linearThreshold;
+		auto angular2 = angularThreshold * angularThreshold;
+		for (auto& i : m_bones)
+		{
+			auto& rig = i->m_rig;
+			if (!rig.isKinematicObject()) continue;
+			if (rig.getLinearVelocity().length2() > linear2 || rig.getAngularVelocity().length2() > angular2)
+				return true;
+		}
+		return false;
+	}
+
+	float SkinnedMeshSystem::kineticEnergy() const
+	{
+		float energy = 0;
+		float mass = 0;
+		for (auto& i : m_bones)
+		{
+			auto& rig = i->m_rig;
+			if (rig.isStaticOrKinematicObject() || rig.getInvMass() <= 0) continue;
+
+			auto m = 1 / rig.getInvMass();
+			auto w = rig.getAngularVelocity() * rig.getWorldTransform().getBasis();
+			auto invInertia = rig.getInvInertiaDiagLocal();
+			float rotational = 0;
+			for (int j = 0; j < 3; ++j)
+				if (invInertia[j] > 0)
+					rotational += w[j] * w[j] / invInertia[j];
+
+			energy += 0.5f * (m * rig.getLinearVelocity().length2() + rotational);
+			mass += m;
 		}
+		return mass > 0 ? energy / mass : 0;
 	}
 
 	void SkinnedMeshSystem::internalUpdate()
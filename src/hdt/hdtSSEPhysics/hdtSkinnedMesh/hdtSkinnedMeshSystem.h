@@ -23,16 +23,46 @@ namespace hdt
 		std::vector<Ref<BoneScaleConstraint>> m_constraints;
 		std::vector<Ref<ConstraintGroup>> m_constraintGroups;
 
-		virtual void readTransform(float timeStep);
+		inline void readTransform(float timeStep) { readBoneTransform(prepareReadTransform(timeStep)); }
 		virtual void writeTransform();
 
+		// serial part of readTransform, state shared with other systems (the scene graph) is only touched here.
+		// returns the time step the bones should be read with
+		virtual float prepareReadTransform(float timeStep) { return timeStep; }
+		// rest of readTransform, safe to run for many systems in parallel
+		virtual void readBoneTransform(float timeStep);
+
+		// bodies of systems with the same group are paired in the broadphase without the group bounds test first
+		virtual void* getBroadphaseGroup() { return this; }
+
+		static int ParallelBoneCount;	// systems with more bones read and write them in parallel
+
 		void internalUpdate();
 		//void internalUpdateCL();
 		void gather(std::vector<SkinnedMeshBody*>& bodies, std::vector<SkinnedMeshShape*>& shapes);
 
 		inline bool valid() const { return !m_bones.empty(); }
+
+		// inactive systems keep their state but are left out of the simulation step
+		void setActive(bool active);
+		inline bool isActive() const { return m_active && !m_sleeping; }
+
+		// a sleeping system is inactive until its skeleton moves or an awake body touches it
+		void sleep();
+		void wakeUp();
+		inline bool isSleeping() const { return m_sleeping; }
+		bool isKinematicMoving(float linearThreshold, float angularThreshold) const;
+		float kineticEnergy() const;	// of the dynamic bones, per unit mass
+
+		float m_sleepTime = 0;	// time spent at rest
 		
 		std::vector<std::shared_ptr<btCollisionShape>> m_shapeRefs;
 		SkinnedMeshWorld* m_world = nullptr;
+
+	protected:
+		void applyActivationState();
+
+		bool m_active = true;
+		bool m_sleeping = false;
 	};
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "hdtSkinnedMeshWorld.h"
 #include "hdtSkinnedMeshAlgorithm.h"
 #include "hdtDispatcher.h"
+#include "hdtBroadphase.h"
 #include "hdtSimulationIslandManager.h"
 #include "hdtBoneScaleConstraint.h"
 
@@ -18,11 +19,16 @@ namespace hdt
 		SkinnedMeshAlgorithm::registerAlgorithm(collisionDispatcher);
 		m_dispatcher1 = collisionDispatcher;
 
-		auto broadphase = new btDbvtBroadphase();
+		auto broadphase = new SkinnedMeshBroadphase();
 		m_broadphasePairCache = broadphase;
+		collisionDispatcher->m_broadphase = broadphase;
 
-		//m_islandManager->~btSimulationIslandManager();
-		//new (m_islandManager) SimulationIslandManager();
+		// objects of inactive systems keep their old bounds
+		setForceUpdateAllAabbs(false);
+
+		m_islandManager->~btSimulationIslandManager();
+		btAlignedFree(m_islandManager);
+		m_islandManager = new (btAlignedAlloc(sizeof(SimulationIslandManager), 16)) SimulationIslandManager();
 	}
 
 	SkinnedMeshWorld::~SkinnedMeshWorld()
@@ -50,14 +56,18 @@ namespace hdt
 			return;
 
 		m_systems.push_back(system);
+		system->setActive(true);
+		system->wakeUp();
 
+		auto broadphase = static_cast<SkinnedMeshBroadphase*>(m_broadphasePairCache);
 		for (int i = 0; i < system->m_meshes.size(); ++i)
+		{
+			system->m_meshes[i]->compileFilter(i, system);
 			addCollisionObject(system->m_meshes[i], 1, 1);
+			broadphase->setGroup(system->m_meshes[i]->getBroadphaseHandle(), system->getBroadphaseGroup());
+		}
 		for (int i = 0; i < system->m_bones.size(); ++i)
-		{
-			system->m_bones[i]->m_rig.setActivationState(DISABLE_DEACTIVATION);
 			addRigidBody(&system->m_bones[i]->m_rig, 0, 0);
-		}
 
 		for (auto i : system->m_constraintGroups)
 			for (auto j : i->m_constraints)
@@ -81,7 +91,10 @@ namespace hdt
 				removeConstraint(j->m_constraint);
 
 		for (int i = 0; i < system->m_meshes.size(); ++i)
+		{
 			removeCollisionObject(system->m_meshes[i]);
+			system->m_meshes[i]->releaseFilter();
+		}
 		for (int i = 0; i < system->m_constraints.size(); ++i)
 			removeConstraint(system->m_constraints[i]->m_constraint);
 		for (int i = 0; i < system->m_bones.size(); ++i)
@@ -116,8 +129,10 @@ namespace hdt
 
 	void SkinnedMeshWorld::performDiscreteCollisionDetection()
 	{
+		++SkinnedMeshBody::UpdateStamp;
 		for (int i = 0; i < m_systems.size(); ++i)
-			m_systems[i]->internalUpdate();
+			if (m_systems[i]->isActive())
+				m_systems[i]->internalUpdate();
 
 		btDiscreteDynamicsWorld::performDiscreteCollisionDetection();
 	}
@@ -126,6 +141,7 @@ namespace hdt
 	{
 		for (auto& i : m_systems)
 		{
+			if (!i->isActive()) continue;
 			for (auto& j : i->m_bones)
 			{
 				auto body = &j->m_rig;
@@ -144,6 +160,7 @@ namespace hdt
 		for (int i = 0; i<m_nonStaticRigidBodies.size(); i++)
 		{
 			btRigidBody* body = m_nonStaticRigidBodies[i];
+			if (!body->isActive()) continue;
 			if (!body->isStaticOrKinematicObject())
 			{
 				// not realistic, just an approximate
@@ -163,7 +180,7 @@ namespace hdt
 		for (int i = 0; i < m_collisionObjects.size(); ++i)
 		{
 			auto body = m_collisionObjects[i];
-			if (body->isKinematicObject())
+			if (body->isKinematicObject() && body->isActive())
 			{
 				btTransformUtil::integrateTransform(
 					body->getWorldTransform(),
@@ -194,24 +211,70 @@ namespace hdt
 		btDiscreteDynamicsWorld::integrateTransforms(timeStep);
 	}
 
+	void SkinnedMeshWorld::calculateSimulationIslands()
+	{
+		BT_PROFILE("calculateSimulationIslands");
+		static_cast<SimulationIslandManager*>(m_islandManager)->buildIslands(m_systems, getCollisionWorld(), getDispatcher());
+	}
+
 	void SkinnedMeshWorld::solveConstraints(btContactSolverInfo& solverInfo)
 	{
 		BT_PROFILE("solveConstraints");
-		if (!m_collisionObjects.size()) return;
 
-		m_constraintSolver.prepareSolve(getCollisionWorld()->getNumCollisionObjects(), getCollisionWorld()->getDispatcher()->getNumManifolds());
+		auto islandManager = static_cast<SimulationIslandManager*>(m_islandManager);
+		int numIslands = islandManager->numIslands();
+		while ((int)m_islandSolvers.size() + 1 < numIslands)
+			m_islandSolvers.push_back(std::make_unique<GroupConstraintSolver>());
+
+		// islands share no bodies, each one is solved on its own with its own solver body pool
+		bool parallel = numIslands > 1;
+		auto solve = [&](int i)
+		{
+			auto& island = islandManager->getIsland(i);
+			auto solver = i ? m_islandSolvers[i - 1].get() : &m_constraintSolver;
+
+			solver->m_multithreaded = !parallel;
+			solver->m_groups = island.m_groups;
+			solver->prepareSolve(island.m_bodies.size(), island.m_manifolds.size());
+			solver->solveGroup(island.m_bodies.data(), island.m_bodies.size(), island.m_manifolds.data(), island.m_manifolds.size(), island.m_constraints.data(), island.m_constraints.size(), solverInfo, m_debugDrawer, m_dispatcher1);
+			solver->allSolved(solverInfo, m_debugDrawer);
+			solver->m_groups.clear();
+		};
+
+		if (parallel)
+			concurrency::parallel_for(0, numIslands, solve);
+		else if (numIslands)
+			solve(0);
 
-		m_constraintSolver.m_groups.clear();
+		((CollisionDispatcher*)m_dispatcher1)->clearAllManifold();
+	}
+
+	void SkinnedMeshWorld::updateActivationState(btScalar timeStep)
+	{
 		for (auto& i : m_systems)
-			for (auto& j : i->m_constraintGroups)
-				m_constraintSolver.m_groups.push_back(j);
+		{
+			if (i->isSleeping())
+			{
+				// bodies touched by an awake body during this step were activated by the dispatcher
+				for (auto& j : i->m_meshes)
+				{
+					if (j->getActivationState() == ACTIVE_TAG)
+					{
+						i->wakeUp();
+						break;
+					}
+				}
+				continue;
+			}
 
-		btPersistentManifold** manifold = m_dispatcher1->getInternalManifoldPointer();
-		int maxNumManifolds = m_dispatcher1->getNumManifolds();
-		m_constraintSolver.solveGroup(&m_collisionObjects[0], m_collisionObjects.size(), manifold, maxNumManifolds, &m_constraints[0], m_constraints.size(), solverInfo, m_debugDrawer, m_dispatcher1);
+			if (!i->isActive()) continue;
 
-		m_constraintSolver.allSolved(solverInfo, m_debugDrawer);
-		((CollisionDispatcher*)m_dispatcher1)->clearAllManifold();
-		m_constraintSolver.m_groups.clear();
+			if (!m_sleepSetting.m_enabled
+				|| i->isKinematicMoving(m_sleepSetting.m_kinematicLinearThreshold, m_sleepSetting.m_kinematicAngularThreshold)
+				|| i->kineticEnergy() > m_sleepSetting.m_energyThreshold)
+				i->m_sleepTime = 0;
+			else if ((i->m_sleepTime += timeStep) > m_sleepSetting.m_time)
+				i->sleep();
+		}
 	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hdtGroupConstraintSolver.h"
+#include <memory>
 
 namespace hdt
 {
@@ -18,27 +19,42 @@ namespace hdt
 
 		btVector3& getWind(){ return m_windSpeed; }
 		const btVector3& getWind() const { return m_windSpeed; }
+
+		struct SleepSetting
+		{
+			bool	m_enabled = false;				// off by default, systems stay awake as they always did
+			float	m_kinematicLinearThreshold = 2.0f;	// skeleton bone speed that keeps or wakes a system
+			float	m_kinematicAngularThreshold = 0.05f;
+			float	m_energyThreshold = 2.0f;			// kinetic energy of dynamic bones per unit mass
+			float	m_time = 1.0f;						// time at rest before falling asleep
+		};
+
+		inline SleepSetting& getSleepSetting() { return m_sleepSetting; }
 		
 	protected:
 
-		inline void readTransform(float timeStep){ for (int i = 0; i < m_systems.size(); ++i) m_systems[i]->readTransform(timeStep); }
-		inline void writeTransform(){ for (int i = 0; i < m_systems.size(); ++i) m_systems[i]->writeTransform(); }
+		virtual void readTransform(float timeStep){ for (int i = 0; i < m_systems.size(); ++i) m_systems[i]->readTransform(timeStep); }
+		virtual void writeTransform(){ for (int i = 0; i < m_systems.size(); ++i) m_systems[i]->writeTransform(); }
 		
 		virtual void applyGravity() override;
 
 		virtual void predictUnconstraintMotion(btScalar timeStep);
 		virtual void integrateTransforms(btScalar timeStep);
 		virtual void performDiscreteCollisionDetection();
+		virtual void calculateSimulationIslands() override;
 		virtual void solveConstraints(btContactSolverInfo& solverInfo);
+		virtual void updateActivationState(btScalar timeStep) override;
 
 		std::vector<Ref<SkinnedMeshSystem>> m_systems;
 
 		btVector3 m_windSpeed;
+		SleepSetting m_sleepSetting;
 
 		std::vector<SkinnedMeshBody*> _bodies;
 		std::vector<SkinnedMeshShape*> _shapes;
 
 		GroupConstraintSolver m_constraintSolver;
+		std::vector<std::unique_ptr<GroupConstraintSolver>> m_islandSolvers;	// islands after the first one
 	};
 
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "hdtVertex.h"
 
+#include <map>
+#include <tuple>
+
 namespace hdt
 {
 	void Vertex::sortWeight()
@@ -16,4 +19,110 @@ namespace hdt
 			}
 		}
 	}
+
+	void VertexStream::build(const std::vector<Vertex>& vertices)
+	{
+		// group by bones and weights quantized to 8 bits. cluster weights are renormalized to the vertices' own weight sum,
+		// so the quantization only shifts a vertex along the way between its bones' results, by at most about 1/255 of it
+		std::map<std::tuple<U32, U32, U32, U32, U32>, std::vector<U32>> groups;
+		for (U32 i = 0; i < vertices.size(); ++i)
+		{
+			auto& v = vertices[i];
+			U32 weights = 0;
+			U32 bones[4] = { 0, 0, 0, 0 };
+			for (int j = 0; j < 4; ++j)
+			{
+				U32 w = (U32)(v.m_weight[j] * 255 + 0.5f);
+				weights |= std::min(w, 255U) << (j * 8);
+				if (w) bones[j] = v.getBoneIdx(j);
+			}
+			groups[std::make_tuple(bones[0], bones[1], bones[2], bones[3], weights)].push_back(i);
+		}
+
+		m_clusters.clear();
+		m_index.clear();
+		m_slots.resize(vertices.size());
+		for (auto& i : groups)
+		{
+			if (i.second.size() < VertexCluster::MinSize)
+			{
+				for (auto j : i.second)
+				{
+					m_slots[j] = { Unclustered, static_cast<U32>(m_index.size()) };
+					m_index.push_back(j);
+				}
+				continue;
+			}
+
+			m_clusters.push_back(VertexCluster());
+			auto& c = m_clusters.back();
+			auto& v = vertices[i.second[0]];
+			U32 weights = std::get<4>(i.first);
+			float sum = 0;
+			for (auto j : i.second)
+				sum += vertices[j].m_weight[0] + vertices[j].m_weight[1] + vertices[j].m_weight[2] + vertices[j].m_weight[3];
+			sum /= i.second.size();
+
+			U32 quantizedSum = 0;
+			for (int j = 0; j < 4; ++j)
+				quantizedSum += (weights >> (j * 8)) & 0xFF;
+			for (int j = 0; j < 4; ++j)
+			{
+				c.m_boneIdx[j] = v.getBoneIdx(j);
+				c.m_weight[j] = quantizedSum ? ((weights >> (j * 8)) & 0xFF) * sum / quantizedSum : 0;
+			}
+
+			c.m_vertices = i.second;
+			for (auto j : i.second)
+			{
+				m_slots[j] = { static_cast<U32>(m_clusters.size() - 1), static_cast<U32>(c.m_skinPos.size()) };
+				c.m_skinPos.push_back(vertices[j].m_skinPos);
+			}
+		}
+
+		m_count = m_index.size();
+		m_size = (m_count + Width - 1) / Width * Width;
+		for (int i = 0; i < 3; ++i)
+			m_skinPos[i].assign(m_size, 0);
+		for (int i = 0; i < 4; ++i)
+		{
+			m_weight[i].assign(m_size, 0);
+			m_boneIdx[i].assign(m_size, 0);
+		}
+
+		btVector3 posMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		m_posMin.setValue(FLT_MAX, FLT_MAX, FLT_MAX);
+		for (auto& i : vertices)
+		{
+			m_posMin.setMin(i.m_skinPos);
+			posMax.setMax(i.m_skinPos);
+		}
+		if (vertices.empty())
+			m_posMin = posMax = btVector3(0, 0, 0);
+		m_posScale = (posMax - m_posMin) / 65535;
+
+		auto quantize = [](float x) { return (U16)std::min(std::max(x * 65535 + 0.5f, 0.f), 65535.f); };
+		for (int i = 0; i < m_count; ++i)
+		{
+			auto& v = vertices[m_index[i]];
+			for (int j = 0; j < 3; ++j)
+			{
+				float extent = m_posScale[j] * 65535;
+				m_skinPos[j][i] = extent > 0 ? quantize((v.m_skinPos[j] - m_posMin[j]) / extent) : 0;
+			}
+			// rounding error of the weights goes to the largest one, so they add up to the vertex's own sum
+			int sum = quantize(v.m_weight[0] + v.m_weight[1] + v.m_weight[2] + v.m_weight[3]);
+			int largest = 0;
+			for (int j = 0; j < 4; ++j)
+			{
+				assert(v.getBoneIdx(j) <= 0xFFFF);
+				m_weight[j][i] = quantize(v.m_weight[j]);
+				m_boneIdx[j][i] = v.getBoneIdx(j);
+				sum -= m_weight[j][i];
+				if (v.m_weight[j] > v.m_weight[largest])
+					largest = j;
+			}
+			m_weight[largest][i] = (U16)btClamped(m_weight[largest][i] + sum, 0, 65535);
+		}
+	}
 }
@@ -44,4 +44,46 @@ namespace hdt
 
 		__m128 m_data;
 	};
+
+	// vertices sharing bones and (quantized) weights, skinned with one blended matrix. the weights are renormalized after quantization
+	struct VertexCluster
+	{
+		static constexpr int MinSize = 16;	// smaller groups stay in the stream
+
+		U32 m_boneIdx[4];
+		float m_weight[4];
+		std::vector<U32> m_vertices;
+		vectorA16<btVector3> m_skinPos;
+	};
+
+	// compressed structure of arrays copy of the skin info, which all the CPU skinning paths read : positions quantized to
+	// 16 bits against their aabb, 16 bit normalized weights, 16 bit bone indices and the 32 bit vertex index, laid out for
+	// skinning Width vertices at once. 26 bytes a vertex, 20 for clustered ones, plus the 8 byte slot.
+	// it's a copy for speed, not a memory saving : the Vertex array stays for the OpenCL upload, the contact bone weights
+	// and the build time code
+	struct VertexStream
+	{
+		static constexpr int Width = 8;
+		static constexpr U32 Unclustered = ~0U;
+
+		// where a vertex's skin info is, a lane of the arrays or an entry of a cluster
+		struct Slot
+		{
+			U32 m_cluster;	// Unclustered for a lane
+			U32 m_index;	// lane, or index into the cluster's vertices
+		};
+
+		void build(const std::vector<Vertex>& vertices);
+
+		int m_count = 0;	// vertices not in a cluster
+		int m_size = 0;		// padded to a multiple of Width with zero weighted vertices
+		std::vector<U32> m_index;	// vertex of every lane
+		std::vector<Slot> m_slots;	// slot of every vertex, for skinning single ones
+		std::vector<VertexCluster> m_clusters;
+		btVector3 m_posMin;
+		btVector3 m_posScale;	// aabb extent / 65535
+		std::vector<U16> m_skinPos[3];
+		std::vector<U16> m_weight[4];
+		std::vector<U16> m_boneIdx[4];
+	};
 }
\ No newline at end of file
@@ -22,6 +22,7 @@ namespace hdt
 
 		auto current = m_rig.getWorldTransform();
 		auto dest = m_currentTransform.asTransform() * m_localToRig;
+		m_readTarget = dest;
 
 		auto factor = oldScale / newScale;
 		if (!m_rig.isStaticOrKinematicObject() && !btFuzzyZero(factor - 1))
@@ -41,8 +42,6 @@ namespace hdt
 			m_localToRig.getOrigin() *= factor;
 			m_rigToLocal.getOrigin() *= factor;
 		}
-		m_rig.getCollisionShape()->setLocalScaling(setAll(newScale));
-
 		if (timeStep <= 1e-4f)
 		{
 			m_rig.setWorldTransform(dest);
@@ -87,13 +86,27 @@ namespace hdt
 		//}
 	}
 
+	void SkyrimBone::snapToReadTarget(const btVector3& localOrigin)
+	{
+		auto target = m_readTarget;
+		target.getOrigin() -= localOrigin;
+		m_rig.setWorldTransform(target);
+		m_rig.setInterpolationWorldTransform(target);
+	}
+
 	void SkyrimBone::writeTransform()
+	{
+		writeTransform(btTransform::getIdentity());
+	}
+
+	void SkyrimBone::writeTransform(const btTransform& rootOffset)
 	{
 		//if (m_rig.isStaticOrKinematicObject()) return;
 		auto transform = m_rig.getWorldTransform() * m_rigToLocal;
 
 		m_currentTransform.setBasis(transform.getBasis());
 		m_currentTransform.setOrigin(transform.getOrigin());
+		transform = rootOffset * transform;
 
 		m_node->m_worldTransform.rot = convertBt(transform.getBasis());
 		m_node->m_worldTransform.pos = convertBt(transform.getOrigin());
@@ -13,8 +13,13 @@ namespace hdt
 
 		virtual void readTransform(float timeStep);
 		virtual void writeTransform();
+		void writeTransform(const btTransform& rootOffset);
+
+		// rig transform read from the skeleton, kinematic bones are moved to reach it by the end of the step
+		void snapToReadTarget(const btVector3& localOrigin);
 
 		int			m_depth;
 		NiNode* m_node;
+		btTransform	m_readTarget;
 	};
 }
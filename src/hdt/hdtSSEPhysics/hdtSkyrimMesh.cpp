@@ -41,7 +41,7 @@ namespace hdt
 	}
 
 	static constexpr float PI = 3.1415926535897932384626433832795f;
-	void SkyrimMesh::readTransform(float timeStep)
+	float SkyrimMesh::prepareReadTransform(float timeStep)
 	{
 		auto newRoot = m_skeleton;
 		while (newRoot->m_parent)newRoot = newRoot->m_parent;
@@ -85,13 +85,81 @@ namespace hdt
 			}
 		}
 
-		SkinnedMeshSystem::readTransform(timeStep);
+		m_rootTransform = convertNi(m_skeleton->m_worldTransform);
 		m_oldRoot = newRoot;
+		return timeStep;
+	}
+
+	void SkyrimMesh::readBoneTransform(float timeStep)
+	{
+		SkinnedMeshSystem::readBoneTransform(timeStep);
+
+		// bones were teleported to the skeleton, continuous shapes must not sweep across the jump
+		if (timeStep <= 1e-4f)
+			for (auto& i : m_meshes)
+				i->rebasePrevPositions();
+
+		// bones of a file share its named shapes, so scaling is applied serially in bone order and the last bone wins.
+		// the empty shape is shared by every system, it has nothing to scale anyway
+		for (auto& i : m_bones)
+		{
+			auto shape = i->m_rig.getCollisionShape();
+			if (shape->getShapeType() == EMPTY_SHAPE_PROXYTYPE) continue;
+
+			btVector3 scaling = setAll(i->m_currentTransform.getScale());
+			if (shape->getLocalScaling() != scaling)
+				shape->setLocalScaling(scaling);
+		}
+	}
+
+	void SkyrimMesh::carryBones(const btQsTransform& oldRoot)
+	{
+		auto offset = m_rootTransform.asTransform() * oldRoot.asTransform().inverse();
+		for (auto& i : m_bones)
+		{
+			auto& rig = i->m_rig;
+			rig.setWorldTransform(offset * rig.getWorldTransform());
+			rig.setInterpolationWorldTransform(rig.getWorldTransform());
+			if (rig.isStaticOrKinematicObject()) continue;
+
+			rig.setLinearVelocity(btVector3(0, 0, 0));
+			rig.setAngularVelocity(btVector3(0, 0, 0));
+			rig.setInterpolationLinearVelocity(btVector3(0, 0, 0));
+			rig.setInterpolationAngularVelocity(btVector3(0, 0, 0));
+		}
+
+		for (auto& i : m_meshes)
+			i->rebasePrevPositions();
+	}
+
+	void SkyrimMesh::snapKinematicBones()
+	{
+		for (auto& i : m_bones)
+			if (i->m_rig.isKinematicObject())
+				static_cast<SkyrimBone*>(i())->snapToReadTarget(m_localOrigin);
 	}
 
 	void SkyrimMesh::writeTransform()
 	{
-		SkinnedMeshSystem::writeTransform();
+		auto root = convertNi(m_skeleton->m_worldTransform);
+		if (root.getOrigin() == m_rootTransform.getOrigin() && root.getBasis() == m_rootTransform.getBasis())
+		{
+			SkinnedMeshSystem::writeTransform();
+			return;
+		}
+
+		// skeleton moved since the step was read (async update), carry the result along
+		auto offset = root.asTransform() * m_rootTransform.asTransform().inverse();
+		auto write = [&](int i)
+		{
+			if (m_bones[i]->m_rig.isKinematicObject()) return;
+			static_cast<SkyrimBone*>(m_bones[i]())->writeTransform(offset);
+		};
+
+		if (m_bones.size() >= ParallelBoneCount)
+			concurrency::parallel_for(0, (int)m_bones.size(), write);
+		else for (int i = 0; i < m_bones.size(); ++i)
+			write(i);
 	}
 
 	btEmptyShape SkyrimMeshParser::BoneTemplate::emptyShape[1];
@@ -861,6 +929,18 @@ namespace hdt
 				{
 					shape->m_windEffect = m_reader->readFloat();
 				}
+				else if (name == "continuous-collision")
+					shape->m_continuous = m_reader->readBool();
+				else if (name == "collider-tree")
+				{
+					auto str = m_reader->readText();
+					if (str == "bvh")
+						shape->m_useBvh = true;
+					else if (str == "bone")
+						shape->m_useBvh = false;
+					else
+						Warning("unknown collider-tree value, use default value \"bone\"");
+				}
 				else
 				{
 					Warning("unknown element - %s", name.c_str());
@@ -965,6 +1045,18 @@ namespace hdt
 				{
 					shape->m_windEffect = m_reader->readFloat();
 				}
+				else if (name == "continuous-collision")
+					shape->m_continuous = m_reader->readBool();
+				else if (name == "collider-tree")
+				{
+					auto str = m_reader->readText();
+					if (str == "bvh")
+						shape->m_useBvh = true;
+					else if (str == "bone")
+						shape->m_useBvh = false;
+					else
+						Warning("unknown collider-tree value, use default value \"bone\"");
+				}
 				else
 				{
 					Warning("unknown element - %s", name.c_str());
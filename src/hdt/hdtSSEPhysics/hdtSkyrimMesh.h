@@ -20,8 +20,10 @@ namespace hdt
 		SkinnedMeshBody* findBody(IDStr name);
 		int findBoneIdx(hdt::IDStr name);
 
-		virtual void readTransform(float timeStep);
-		virtual void writeTransform();
+		virtual float prepareReadTransform(float timeStep) override;
+		virtual void readBoneTransform(float timeStep) override;
+		virtual void writeTransform() override;
+		virtual void* getBroadphaseGroup() override { return m_skeleton(); }
 
 		Ref<NiNode> m_skeleton;
 		Ref<NiNode> m_oldRoot;
@@ -29,6 +31,32 @@ namespace hdt
 
 		// angular velocity damper
 		btQuaternion m_lastRootRotation;
+
+		// skeleton transform the simulation was read against, results are moved along with it when written later
+		btQsTransform m_rootTransform;
+
+		// origin of the local frame the world simulates this system in
+		btVector3 m_localOrigin = btVector3(0, 0, 0);
+
+		// simulation level of detail, chosen by the world every frame
+		enum LODLevel
+		{
+			LOD_FULL,
+			LOD_HALF,
+			LOD_QUARTER,
+			LOD_FROZEN,
+			LOD_COUNT
+		};
+
+		LODLevel	m_lod = LOD_FULL;
+		float		m_lodElapsed = 0;	// time since the system was last read
+		float		m_lodStep = 0;		// m_lodElapsed at the last read, what the step of this frame may simulate
+		bool		m_lodResync = false;	// left LOD_FROZEN, bones follow the skeleton before the next read
+
+		// moves every bone by the change of the skeleton root since it was last read, velocities are dropped
+		void carryBones(const btQsTransform& oldRoot);
+		// the step simulated less time than was read, kinematic bones jump to the pose they were read with so bodies don't trail
+		void snapKinematicBones();
 	};
 
 	class XMLReader;
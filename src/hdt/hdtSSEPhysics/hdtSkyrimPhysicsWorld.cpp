@@ -1,12 +1,21 @@
 #include "hdtSkyrimPhysicsWorld.h"
+#include "hdtSkinnedMesh\hdtBroadphase.h"
+#include <skse64\skse64\GameCamera.h>
 #include <ppl.h>
 
 namespace hdt
 {
 	static const float* timeStamp = (float*)0x12E355C;
 
+	typedef std::chrono::high_resolution_clock Clock;
+	static float elapsedMs(Clock::time_point since)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - since).count();
+	}
+
 	SkyrimPhysicsWorld::SkyrimPhysicsWorld(void)
 	{
+		// bullet never deactivates anything on its own, idle systems are put to sleep by the world when <sleep> is enabled
 		gDisableDeactivation = true;
 		setGravity(btVector3(0, 0, -9.8 * scaleSkyrim));
 		m_windSpeed.setValue(0, 0, 5 * scaleSkyrim);
@@ -18,6 +27,8 @@ namespace hdt
 
 	SkyrimPhysicsWorld::~SkyrimPhysicsWorld(void)
 	{
+		// the worker steps this world, it has to be gone before any member is
+		stopAsyncThread();
 	}
 
 	//void hdtSkyrimPhysicsWorld::suspend()
@@ -58,6 +69,18 @@ namespace hdt
 
 		//ScanHair();
 		
+		interval = accumulateInterval(interval);
+		if (interval > 0)
+		{
+			updateLOD(interval);
+			readTransform(interval);
+			stepWorld(interval, std::min(m_averageInterval, TIME_TICK));
+			writeTransform();
+		}
+	}
+
+	float SkyrimPhysicsWorld::accumulateInterval(float interval)
+	{
 		m_averageInterval = m_averageInterval * 0.875f + interval * 0.125f;
 		auto tick = std::min(m_averageInterval, TIME_TICK);
 
@@ -65,143 +88,475 @@ namespace hdt
 		if (m_accumulatedInterval > tick * 0.25f)
 		{
 			interval = std::min<float>(m_accumulatedInterval, tick * 5);
-
-			readTransform(interval);
-			updateActiveState();
-			auto offset = applyTranslationOffset();
-			stepSimulation(interval, 5, tick);
-			restoreTranslationOffset(offset);
 			m_accumulatedInterval = 0;
-			writeTransform();
+			return interval;
+		}
+		return 0;
+	}
+
+	void SkyrimPhysicsWorld::stepWorld(float interval, float tick)
+	{
+		auto start = Clock::now();
+		applyLocalFrames(true);
+
+		// one pass per level due this frame, every pass steps only the systems of its level.
+		// systems that could touch share a level, so no contact is lost between passes
+		for (int lod = SkyrimMesh::LOD_FULL; lod < SkyrimMesh::LOD_FROZEN; ++lod)
+		{
+			if (!m_lodDue[lod]) continue;
+
+			// time lost by systems that waited longer is dropped rather than stretching the step of the others
+			float step = FLT_MAX;
+			for (auto& i : m_systems)
+			{
+				auto system = static_cast<SkyrimMesh*>(i());
+				system->setActive(system->m_lod == lod);
+				if (system->isActive())
+					step = std::min(step, system->m_lodStep);
+			}
+			if (step == FLT_MAX) continue;
+
+			// with fewer substeps the fixed step grows, but never past MAX_STEP_STRETCH ticks so the solver stays stable
+			float simulated;
+			if (lod == SkyrimMesh::LOD_FULL)
+			{
+				float fixed = std::min(std::max(tick, step / m_maxSubSteps), tick * MAX_STEP_STRETCH);
+				simulated = std::min(step, fixed * m_maxSubSteps);
+				stepSimulation(step, m_maxSubSteps, fixed);
+			}
+			else
+			{
+				simulated = std::min(step, tick * 4);
+				stepSimulation(simulated, 1, simulated);
+			}
+
+			// kinematic velocities were read over the whole interval, whatever wasn't simulated would leave them behind
+			for (auto& i : m_systems)
+			{
+				auto system = static_cast<SkyrimMesh*>(i());
+				if (system->isActive() && system->m_lodStep > simulated * 1.001f)
+					system->snapKinematicBones();
+			}
 		}
+
+		applyLocalFrames(false);
+		m_cost.m_step += elapsedMs(start);
 	}
 
-	btVector3 SkyrimPhysicsWorld::applyTranslationOffset()
+	void SkyrimPhysicsWorld::updateBudget()
 	{
-		btVector3 center;
-		center.setZero();
-		int count = 0;
-		for (int i = 0; i < m_collisionObjects.size(); ++i)
+		auto cost = m_cost.total();
+		m_cost = PhaseCost();
+
+		if (m_budget <= 0)
 		{
-			auto rig = btRigidBody::upcast(m_collisionObjects[i]);
-			if (rig)
+			if (m_budgetLevel)
 			{
-				center += rig->getWorldTransform().getOrigin();
-				++count;
+				m_budgetLevel = 0;
+				applyBudgetLevel();
 			}
+			return;
 		}
 
-		if (count > 0)
+		m_averageCost = m_averageCost * 0.9f + cost * 0.1f;
+		if (m_budgetCooldown > 0)
 		{
-			center /= count;
-			for (int i = 0; i < m_collisionObjects.size(); ++i)
+			--m_budgetCooldown;
+			return;
+		}
+
+		// drop quickly, recover slowly so the levels don't oscillate
+		static const int MaxBudgetLevel = 4;
+		if (m_averageCost > m_budget && m_budgetLevel < MaxBudgetLevel)
+		{
+			if (!m_budgetLevel)
 			{
-				auto rig = btRigidBody::upcast(m_collisionObjects[i]);
-				if (rig)
-				{
-					rig->getWorldTransform().getOrigin() -= center;
-				}
+				m_baseIterations = getSolverInfo().m_numIterations;
+				m_baseGroupIterations = ConstraintGroup::MaxIterations;
 			}
-			return center;
+			++m_budgetLevel;
+			applyBudgetLevel();
+			m_budgetCooldown = 10;
+		}
+		else if (m_averageCost < m_budget * 0.5f && m_budgetLevel > 0)
+		{
+			--m_budgetLevel;
+			applyBudgetLevel();
+			m_budgetCooldown = 60;
+		}
+	}
+
+	void SkyrimPhysicsWorld::applyBudgetLevel()
+	{
+		static const int subSteps[] = { 5, 3, 2, 1, 1 };
+		auto level = m_budgetLevel;
+
+		m_maxSubSteps = subSteps[level];
+		m_lodBias = std::max(level - 2, 0);
+		if (level)
+		{
+			getSolverInfo().m_numIterations = std::max(m_baseIterations * (4 - std::min(level, 3)) / 4, 4);
+			ConstraintGroup::MaxIterations = std::max(m_baseGroupIterations >> level, std::min(m_baseGroupIterations, 1));
+		}
+		else
+		{
+			getSolverInfo().m_numIterations = m_baseIterations;
+			ConstraintGroup::MaxIterations = m_baseGroupIterations;
 		}
-		return center;
 	}
 
-	void SkyrimPhysicsWorld::restoreTranslationOffset(const btVector3& offset)
+	void SkyrimPhysicsWorld::updateLOD(float interval)
 	{
-		for (int i = 0; i < m_collisionObjects.size(); ++i)
+		// stagger the reduced levels so they never land on the same frame
+		++m_lodFrame;
+		bool due[SkyrimMesh::LOD_COUNT] = { true, (m_lodFrame & 1) == 1, (m_lodFrame & 3) == 2, false };
+		std::copy(due, due + SkyrimMesh::LOD_COUNT, m_lodDue);
+
+		auto camera = PlayerCamera::GetSingleton();
+		bool useLOD = m_lodSetting.m_enabled && camera && camera->cameraNode;
+		btVector3 cameraPos = useLOD ? convertNi(camera->cameraNode->m_worldTransform.pos) : btVector3(0, 0, 0);
+		float fov = (useLOD && camera->worldFOV > 1) ? camera->worldFOV : 75;
+		float tanHalfFov = std::tan(fov * 0.5f * SIMD_RADS_PER_DEG);
+
+		_lods.resize(m_systems.size());
+		for (int i = 0; i < m_systems.size(); ++i)
 		{
-			auto rig = btRigidBody::upcast(m_collisionObjects[i]);
-			if (rig)
+			auto system = static_cast<SkyrimMesh*>(m_systems[i]());
+			system->m_lodElapsed += interval;
+
+			auto lod = SkyrimMesh::LOD_FULL;
+			if (useLOD)
 			{
-				rig->getWorldTransform().getOrigin() += offset;
+				float distance = (convertNi(system->m_skeleton->m_worldTransform.pos) - cameraPos).length();
+				if (distance >= m_lodSetting.m_frozenDistance)
+					lod = SkyrimMesh::LOD_FROZEN;
+				else if (distance >= m_lodSetting.m_quarterRateDistance)
+					lod = SkyrimMesh::LOD_QUARTER;
+				else if (distance >= m_lodSetting.m_halfRateDistance)
+					lod = SkyrimMesh::LOD_HALF;
+
+				Aabb aabb;
+				for (auto& j : system->m_meshes)
+					aabb.merge(j->m_bulletShape.m_aabb);
+				auto extent = btVector3(aabb.m_max) - btVector3(aabb.m_min);
+				float radius = extent.x() >= 0 ? extent.length() * 0.5f : 0;
+
+				float screenSize = radius / std::max(distance * tanHalfFov, 1.f);
+				if (lod != SkyrimMesh::LOD_FROZEN && radius > 0 && screenSize < m_lodSetting.m_minScreenSize)
+					lod = (SkyrimMesh::LODLevel)(lod + 1);
 			}
+
+			// over the frame budget, with or without distance LOD
+			if (lod != SkyrimMesh::LOD_FROZEN)
+				lod = (SkyrimMesh::LODLevel)std::min(lod + m_lodBias, (int)SkyrimMesh::LOD_QUARTER);
+			_lods[i] = lod;
+		}
+
+		// skeletons that could touch are stepped together, at the finest level among them
+		updateFrameGroups();
+		for (int i = 0; i < m_systems.size(); ++i)
+		{
+			auto group = findFrameGroup(i);
+			_lods[group] = std::min(_lods[group], _lods[i]);
+		}
+
+		for (int i = 0; i < m_systems.size(); ++i)
+		{
+			auto system = static_cast<SkyrimMesh*>(m_systems[i]());
+			auto lod = (SkyrimMesh::LODLevel)_lods[findFrameGroup(i)];
+
+			// frozen systems are showing the animated pose, their bones are moved to it when they are read again
+			if (system->m_lod == SkyrimMesh::LOD_FROZEN && lod != SkyrimMesh::LOD_FROZEN)
+				system->m_lodResync = true;
+			system->m_lod = lod;
 		}
 	}
 
-	void SkyrimPhysicsWorld::updateActiveState()
+	void SkyrimPhysicsWorld::readTransform(float timeStep)
 	{
-		struct Group
+		auto start = Clock::now();
+
+		// scene graph fixes are serial, systems of one skeleton share its nodes
+		_reads.clear();
+		for (auto& i : m_systems)
 		{
-			std::unordered_set<hdt::IDStr> tags;
-			std::unordered_map<hdt::IDStr, std::vector<SkyrimShape*>> list;
-		};
+			auto system = static_cast<SkyrimMesh*>(i());
+			if (!m_lodDue[system->m_lod]) continue;
 
-		std::unordered_map<NiNode*, Group> maps;
+			auto oldRoot = system->m_rootTransform;
+			auto timeStep = system->prepareReadTransform(system->m_lodElapsed);
+			if (system->m_lodResync && timeStep > 0)
+				system->carryBones(oldRoot);
+			system->m_lodResync = false;
 
-		hdt::IDStr invalidString;
+			_reads.push_back(std::make_pair(system, timeStep));
+			system->m_lodStep = system->m_lodElapsed;
+			system->m_lodElapsed = 0;
+		}
+
+		concurrency::parallel_for_each(_reads.begin(), _reads.end(), [](const std::pair<SkinnedMeshSystem*, float>& i) {
+			i.first->readBoneTransform(i.second);
+		});
+		updateLocalFrames();
+		m_cost.m_read += elapsedMs(start);
+	}
+
+	void SkyrimPhysicsWorld::writeTransform()
+	{
+		auto start = Clock::now();
+
+		_writes.clear();
 		for (auto& i : m_systems)
 		{
 			auto system = static_cast<SkyrimMesh*>(i());
-			auto& map = maps[system->m_skeleton];
-			for (auto& j : i->m_meshes)
+			if (system->m_lod == SkyrimMesh::LOD_FROZEN || !system->m_initialized) continue;
+
+			_writes.push_back(system);
+		}
+
+		// systems of one skeleton can write the same nodes, each skeleton is written serially in the old order so the last system wins
+		std::stable_sort(_writes.begin(), _writes.end(), [](SkyrimMesh* a, SkyrimMesh* b) { return a->m_skeleton() < b->m_skeleton(); });
+		_writeGroups.clear();
+		for (int i = 0; i < _writes.size(); ++i)
+			if (!i || _writes[i]->m_skeleton() != _writes[i - 1]->m_skeleton())
+				_writeGroups.push_back(i);
+		_writeGroups.push_back(_writes.size());
+
+		concurrency::parallel_for(0, (int)_writeGroups.size() - 1, [this](int i) {
+			for (int j = _writeGroups[i]; j < _writeGroups[i + 1]; ++j)
+				_writes[j]->writeTransform();
+		});
+		m_cost.m_write += elapsedMs(start);
+	}
+
+	void SkyrimPhysicsWorld::doAsyncUpdate(float interval)
+	{
+		_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+
+		interval = accumulateInterval(interval);
+		if (interval > 0)
+		{
+			updateLOD(interval);
+			readTransform(interval);
+
+			auto tick = std::min(m_averageInterval, TIME_TICK);
+			if (!m_asyncThread.joinable())
+				startAsyncThread();
+
+			std::lock_guard<decltype(m_asyncLock)> l(m_asyncLock);
+			m_asyncInterval = interval;
+			m_asyncTick = tick;
+			m_asyncPending = true;
+			m_asyncHasResult = true;
+			m_asyncCond.notify_all();
+		}
+	}
+
+	void SkyrimPhysicsWorld::asyncLoop()
+	{
+		_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+
+		std::unique_lock<decltype(m_asyncLock)> l(m_asyncLock);
+		while (true)
+		{
+			m_asyncCond.wait(l, [this]() { return m_asyncPending || m_asyncExit; });
+			if (m_asyncExit) break;
+
+			auto interval = m_asyncInterval;
+			auto tick = m_asyncTick;
+			l.unlock();
+			stepWorld(interval, tick);
+			l.lock();
+
+			m_asyncPending = false;
+			m_asyncCond.notify_all();
+		}
+	}
+
+	void SkyrimPhysicsWorld::startAsyncThread()
+	{
+		m_asyncExit = false;
+		m_asyncThread = std::thread([this]() { asyncLoop(); });
+	}
+
+	void SkyrimPhysicsWorld::stopAsyncThread()
+	{
+		if (!m_asyncThread.joinable()) return;
+
+		{
+			std::lock_guard<decltype(m_asyncLock)> l(m_asyncLock);
+			m_asyncExit = true;
+			m_asyncCond.notify_all();
+		}
+		m_asyncThread.join();
+	}
+
+	// must be called with m_lock held, so no new step can be handed out while waiting
+	void SkyrimPhysicsWorld::waitAsyncStep()
+	{
+		std::unique_lock<decltype(m_asyncLock)> l(m_asyncLock);
+		m_asyncCond.wait(l, [this]() { return !m_asyncPending; });
+	}
+
+	void SkyrimPhysicsWorld::updateFrameGroups()
+	{
+		// skeletons close enough to touch share a frame, so contacts between them stay consistent
+		_frames.resize(m_systems.size());
+		for (int i = 0; i < m_systems.size(); ++i)
+			_frames[i] = i;
+
+		for (int i = 0; i < m_systems.size(); ++i)
+		{
+			auto a = convertNi(static_cast<SkyrimMesh*>(m_systems[i]())->m_skeleton->m_worldTransform.pos);
+			for (int j = i + 1; j < m_systems.size(); ++j)
 			{
-				auto shape = static_cast<SkyrimShape*>(j());
-				if (!shape) continue;
+				auto b = convertNi(static_cast<SkyrimMesh*>(m_systems[j]())->m_skeleton->m_worldTransform.pos);
+				if (a.distance2(b) < LOCAL_FRAME_RADIUS * LOCAL_FRAME_RADIUS)
+					_frames[findFrameGroup(j)] = findFrameGroup(i);
+			}
+		}
+	}
 
-				if (shape->m_disableTag == invalidString)
-				{
-					for (auto& k : shape->m_tags)
-						map.tags.insert(k);
-				}
-				else
+	int SkyrimPhysicsWorld::findFrameGroup(int i)
+	{
+		while (_frames[i] != i) i = _frames[i] = _frames[_frames[i]];
+		return i;
+	}
+
+	void SkyrimPhysicsWorld::updateLocalFrames()
+	{
+		// far apart frames all end up around the origin, the broadphase must not pair bodies across them
+		auto broadphase = static_cast<SkinnedMeshBroadphase*>(m_broadphasePairCache);
+		for (int i = 0; i < m_systems.size(); ++i)
+		{
+			auto frame = findFrameGroup(i);
+			auto anchor = static_cast<SkyrimMesh*>(m_systems[frame]());
+			auto system = static_cast<SkyrimMesh*>(m_systems[i]());
+			broadphase->setGroupFrame(system->getBroadphaseGroup(), frame);
+
+			// vertices of the last step are moved into the new frame before continuous shapes sweep from them
+			auto shift = system->m_localOrigin - anchor->m_rootTransform.getOrigin();
+			system->m_localOrigin = anchor->m_rootTransform.getOrigin();
+			if (!shift.fuzzyZero())
+				for (auto& j : system->m_meshes)
 				{
-					map.list[shape->m_disableTag].push_back(shape);
+					j->shiftPrevPositions(shift);
+
+					// bodies of sleeping systems aren't updated and their broadphase bounds aren't refreshed, they are moved
+					// with the frame so an awake body touching them still finds them and wakes them up
+					if (!system->isActive())
+					{
+						j->shiftBounds(shift);
+						updateSingleAabb(j);
+					}
 				}
-			}
 		}
+	}
 
-		for (auto& i : maps)
+	void SkyrimPhysicsWorld::applyLocalFrames(bool toLocal)
+	{
+		for (auto& i : m_systems)
 		{
-			for (auto& j : i.second.list)
+			auto system = static_cast<SkyrimMesh*>(i());
+			auto offset = toLocal ? -system->m_localOrigin : system->m_localOrigin;
+			for (auto& j : system->m_bones)
+				j->m_rig.getWorldTransform().getOrigin() += offset;
+		}
+	}
+
+	void SkyrimPhysicsWorld::indexDisableTags(SkyrimMesh* system, bool add)
+	{
+		auto& group = m_disableGroups[system->m_skeleton];
+		for (auto& j : system->m_meshes)
+		{
+			auto shape = static_cast<SkyrimShape*>(j());
+			if (!shape) continue;
+
+			if (shape->m_disableTag == IDStr())
 			{
-				if (i.second.tags.find(j.first) != i.second.tags.end())
+				for (auto& k : shape->m_tags)
 				{
-					for (auto& k : j.second)
-						k->m_disabled = true;
+					if (add) ++group.tags[k];
+					else if (!--group.tags[k]) group.tags.erase(k);
 				}
-				else if (j.second.size())
+			}
+			else
+			{
+				auto& list = group.list[shape->m_disableTag];
+				if (add)
 				{
-					std::sort(j.second.begin(), j.second.end(), [](SkyrimShape* a, SkyrimShape* b) {
+					auto pos = std::upper_bound(list.begin(), list.end(), shape, [](SkyrimShape* a, SkyrimShape* b) {
 						if (a->m_disablePriority != b->m_disablePriority)
 							return a->m_disablePriority > b->m_disablePriority;
 						return a < b;
 					});
-
-					for (auto& k : j.second)
-						k->m_disabled = true;
-					j.second[0]->m_disabled = false;
+					list.insert(pos, shape);
+				}
+				else
+				{
+					list.erase(std::remove(list.begin(), list.end(), shape), list.end());
+					if (list.empty()) group.list.erase(shape->m_disableTag);
 				}
 			}
 		}
+
+		if (group.tags.empty() && group.list.empty())
+			m_disableGroups.erase(system->m_skeleton);
+		else updateActiveState(group);
+	}
+
+	void SkyrimPhysicsWorld::updateActiveState(DisableGroup& group)
+	{
+		for (auto& j : group.list)
+		{
+			for (auto& k : j.second)
+				k->m_disabled = true;
+
+			// lists are kept sorted by priority, the first one wins unless a tagged shape covers it
+			if (group.tags.find(j.first) == group.tags.end())
+				j.second[0]->m_disabled = false;
+		}
 	}
 
 	void SkyrimPhysicsWorld::addSkinnedMeshSystem(hdt::SkinnedMeshSystem* system)
 	{
 		std::lock_guard<decltype(m_lock)> l(m_lock);
+		waitAsyncStep();
 		auto s = dynamic_cast<SkyrimMesh*>(system);
 		if (!s) return;
 
+		if (std::find(m_systems.begin(), m_systems.end(), system) != m_systems.end())
+			return;
+
 		s->m_initialized = false;
 		hdt::SkinnedMeshWorld::addSkinnedMeshSystem(system);
+		indexDisableTags(s, true);
 	}
 
 	void SkyrimPhysicsWorld::removeSkinnedMeshSystem(hdt::SkinnedMeshSystem* system)
 	{
 		std::lock_guard<decltype(m_lock)> l(m_lock);
+		waitAsyncStep();
 
+		auto s = dynamic_cast<SkyrimMesh*>(system);
+		if (s && std::find(m_systems.begin(), m_systems.end(), system) != m_systems.end())
+			indexDisableTags(s, false);
 		hdt::SkinnedMeshWorld::removeSkinnedMeshSystem(system);
 	}
 
 	void SkyrimPhysicsWorld::removeSystemByNode(void* root)
 	{
 		std::lock_guard<decltype(m_lock)> l(m_lock);
+		waitAsyncStep();
 
 		for (int i = 0; i < m_systems.size(); )
 		{
 			Ref<SkyrimMesh> s = m_systems[i].cast<SkyrimMesh>();
 			if (s && s->m_skeleton == root)
+			{
+				indexDisableTags(s, false);
 				hdt::SkinnedMeshWorld::removeSkinnedMeshSystem(s);
+			}
 			else ++i;
 		}
 	}
@@ -209,6 +564,8 @@ namespace hdt
 	void SkyrimPhysicsWorld::resetSystems()
 	{
 		std::lock_guard<decltype(m_lock)> l(m_lock);
+		waitAsyncStep();
+		m_asyncHasResult = false;
 		for (auto& i : m_systems)
 			i->readTransform(0);
 	}
@@ -220,14 +577,30 @@ namespace hdt
 		std::lock_guard<decltype(m_lock)> l(m_lock);
 		float interval = getFramework()->getFrameInterval(false);
 
+		// the worker had a whole frame to finish, hand its result to this frame
+		waitAsyncStep();
+		if (m_asyncHasResult)
+		{
+			writeTransform();
+			m_asyncHasResult = false;
+		}
+		updateBudget();
+
 		if (interval > FLT_EPSILON && !m_suspended && !m_systems.empty())
 		{
-			doUpdate(interval);
+			if (m_asyncUpdate)
+				doAsyncUpdate(interval);
+			else
+				doUpdate(interval);
 		}
 	}
 
 	void SkyrimPhysicsWorld::onEvent(const ShutdownEvent & e)
 	{
+		std::lock_guard<decltype(m_lock)> l(m_lock);
+		stopAsyncThread();
+		m_asyncHasResult = false;
+
 		for (auto system : m_systems)
 		{
 			for (int i = 0; i < system->m_meshes.size(); ++i)
@@ -6,10 +6,15 @@
 #include "../hdtSSEFramework/HookEngine.h"
 
 #include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 namespace hdt
 {
 	static float TIME_TICK = 1 / 60.f;
+	static float LOCAL_FRAME_RADIUS = 512.f;	// skeletons closer than this share a local frame
+	static float MAX_STEP_STRETCH = 2.f;		// fewer substeps may grow the fixed step up to this many ticks
 
 	class SkyrimPhysicsWorld : public SkinnedMeshWorld, public IEventListener<FrameEvent>, public IEventListener<ShutdownEvent>
 	{
@@ -17,8 +22,16 @@ namespace hdt
 
 		static SkyrimPhysicsWorld* get();
 
+		struct LODSetting
+		{
+			bool	m_enabled = false;
+			float	m_halfRateDistance = 1024;
+			float	m_quarterRateDistance = 2048;
+			float	m_frozenDistance = 4096;
+			float	m_minScreenSize = 0.05f;	// smaller systems drop one more level
+		};
+
 		void doUpdate(float delta);
-		void updateActiveState();
 
 		virtual void addSkinnedMeshSystem(SkinnedMeshSystem* system) override;
 		virtual void removeSkinnedMeshSystem(SkinnedMeshSystem* system) override;
@@ -32,18 +45,95 @@ namespace hdt
 		inline void suspend() { m_suspended = true; }
 		inline void resume() { m_suspended = false; }
 
-		btVector3 applyTranslationOffset();
-		void restoreTranslationOffset(const btVector3&);
+		// simulate on a worker thread, one frame behind the renderer
+		inline void setAsyncUpdate(bool async) { m_asyncUpdate = async; }
+
+		inline LODSetting& getLODSetting() { return m_lodSetting; }
+
+		// milliseconds of physics work per frame, fidelity is lowered while over it. 0 for unlimited
+		inline void setBudget(float ms) { m_budget = ms; }
 
 	private:
 
 		SkyrimPhysicsWorld(void);
 		~SkyrimPhysicsWorld(void);
 
+		float accumulateInterval(float interval);
+		void stepWorld(float interval, float tick);
+
+		// shapes with a disable tag, per skeleton. only changes when systems are added or removed
+		struct DisableGroup
+		{
+			std::unordered_map<IDStr, int> tags;	// reference counted tags of the shapes without a disable tag
+			std::unordered_map<IDStr, std::vector<SkyrimShape*>> list;	// sorted by disable priority
+		};
+
+		void indexDisableTags(SkyrimMesh* system, bool add);
+		void updateActiveState(DisableGroup& group);
+
+		// every group of nearby skeletons is simulated around its own origin, so precision doesn't depend on where in the worldspace it is.
+		// groups are found by updateFrameGroups, before the LOD levels that are shared by each group
+		void updateFrameGroups();
+		int findFrameGroup(int i);
+		void updateLocalFrames();
+		void applyLocalFrames(bool toLocal);
+
+		void updateLOD(float interval);
+		void updateBudget();
+		void applyBudgetLevel();
+		virtual void readTransform(float timeStep) override;
+		virtual void writeTransform() override;
+
+		void doAsyncUpdate(float interval);
+		void asyncLoop();
+		void startAsyncThread();
+		void stopAsyncThread();
+		void waitAsyncStep();
+
 		std::mutex m_lock;
 
 		std::atomic_bool m_suspended;
 		float m_averageInterval;
 		float m_accumulatedInterval;
+
+		struct PhaseCost
+		{
+			float m_read = 0;
+			float m_step = 0;
+			float m_write = 0;
+
+			inline float total() const { return m_read + m_step + m_write; }
+		};
+
+		float m_budget = 0;
+		float m_averageCost = 0;
+		PhaseCost m_cost;			// spent since the last budget update, in milliseconds
+		std::vector<std::pair<SkinnedMeshSystem*, float>> _reads;
+		std::vector<SkyrimMesh*> _writes;
+		std::vector<int> _writeGroups;
+		int m_budgetLevel = 0;
+		int m_budgetCooldown = 0;
+		int m_baseIterations = 0;
+		int m_baseGroupIterations = 0;
+		int m_maxSubSteps = 5;
+		int m_lodBias = 0;	// levels added to every non frozen system while over the frame budget, LOD enabled or not
+
+		std::unordered_map<NiNode*, DisableGroup> m_disableGroups;
+		std::vector<int> _frames;
+
+		LODSetting m_lodSetting;
+		U32 m_lodFrame = 0;
+		bool m_lodDue[SkyrimMesh::LOD_COUNT] = {};	// levels stepped this frame
+		std::vector<int> _lods;
+
+		bool m_asyncUpdate = false;
+		bool m_asyncPending = false;	// step handed to the worker, not finished yet
+		bool m_asyncExit = false;
+		bool m_asyncHasResult = false;	// finished step not written back to the skeletons yet
+		float m_asyncInterval = 0;
+		float m_asyncTick = 0;
+		std::thread m_asyncThread;
+		std::mutex m_asyncLock;
+		std::condition_variable m_asyncCond;
 	};
 }